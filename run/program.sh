@@ -25,10 +25,11 @@ inversion="../src/inversion/inversion.cpp"
 
 tomography_iso="../src/inversion/tomography_iso.cpp"
 tomography_vti="../src/inversion/tomography_vti.cpp"
+tomography_adj="../src/inversion/tomography_adj.cu"
 
 inversion_main="../src/inversion_main.cpp"
 
-inversion_all="$inversion $tomography_iso $tomography_vti"
+inversion_all="$inversion $tomography_iso $tomography_vti $tomography_adj"
 
 # Seismic migration scripts ---------------------------------------------------------------------------
 
@@ -41,9 +42,13 @@ migration_main="../src/migration_main.cpp"
 
 migration_all="$migration $kirchhoff_iso $kirchhoff_ani"
 
+# In-process library ---------------------------------------------------------------------------------
+
+library="../src/library/seisfat3d.cpp"
+
 # Compiler flags --------------------------------------------------------------------------------------
 
-flags="-Xcompiler -fopenmp --std=c++11 --relocatable-device-code=true -lm -O3"
+flags="-Xcompiler -fopenmp --std=c++11 --default-stream per-thread --relocatable-device-code=true -lm -O3"
 
 # Main dialogue ---------------------------------------------------------------------------------------
 
@@ -56,6 +61,8 @@ USER_MESSAGE="
         $ $0 -modeling                      
         $ $0 -inversion           
         $ $0 -migration
+        $ $0 -library
+        $ $0 -benchmark
 -------------------------------------------------------------------------------
 "
 
@@ -81,8 +88,8 @@ case "$1" in
     echo -e "../bin/\033[31mmodeling.exe\033[m" 
     nvcc $admin $geometry $modeling_all $modeling_main $flags -o ../bin/modeling.exe
 
-    # echo -e "../bin/\033[31minversion.exe\033[m" 
-    # nvcc $admin $geometry $modeling_all $inversion_all $inversion_main $flags -o ../bin/inversion.exe
+    echo -e "../bin/\033[31minversion.exe\033[m" 
+    nvcc $admin $geometry $modeling_all $inversion_all $inversion_main $flags -o ../bin/inversion.exe
 
     echo -e "../bin/\033[31mmigration.exe\033[m"
     nvcc $admin $geometry $modeling_all $migration_all $migration_main $flags -o ../bin/migration.exe
@@ -90,9 +97,20 @@ case "$1" in
 	exit 0
 ;;
 
+-library)
+
+    echo -e "Compiling the in-process library!\n"
+
+    echo -e "../bin/\033[31mlibseisfat3d.so\033[m"
+    nvcc $admin $geometry $modeling_all $inversion_all $migration_all $library $flags -Xcompiler -fPIC -shared -o ../bin/libseisfat3d.so
+
+	exit 0
+;;
+
 -clean)
 
     rm ../bin/*.exe
+    rm ../bin/*.so
     rm ../inputs/data/*.bin
     rm ../inputs/geometry/*.txt
     rm ../inputs/models/*.bin
@@ -101,6 +119,7 @@ case "$1" in
     rm ../outputs/models/*.bin
     rm ../outputs/data/*.bin
     rm ../outputs/times/*.bin
+    rm ../outputs/checkpoints/*.bin
 ;;
 
 -modeling) 
@@ -164,6 +183,16 @@ case "$1" in
     exit 0
 ;;
 
+-benchmark)
+
+    prefix=../tests/benchmark
+    parameters=$prefix/parameters.txt
+
+    python3 -B $prefix/run_benchmark.py $parameters
+
+	exit 0
+;;
+
 -test_migration)
 
     prefix=../tests/migration
@@ -174,6 +203,7 @@ case "$1" in
     # python3 -B $prefix/generate_input_data.py $parameters
 
     # ./../bin/migration.exe $parameters
+    # python3 -B $prefix/compare_imaging_order.py $parameters
 
     python3 -B $prefix/generate_figures.py $parameters
 
@@ -10,15 +10,47 @@ bool str2bool(std::string s)
     return b;
 }
 
-void import_binary_float(std::string path, float * array, int n)
+static unsigned long long fnv1a(const char * data, size_t bytes, unsigned long long hash = 14695981039346656037ULL)
+{
+    for (size_t i = 0; i < bytes; i++)
+    {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static std::string hex(unsigned long long hash)
+{
+    std::ostringstream output;
+    output << std::hex << hash;
+    return output.str();
+}
+
+// every file read by the run is listed in the resolved configuration. Model, stiffness
+// and geometry files are hashed from the bytes already in memory, seismic data, tables 
+// and other per shot inputs are listed without a hash so nothing is read twice
+
+static std::map<std::string, std::string> input_files;
+
+static void register_input(std::string path, std::string hash = "-")
+{
+    # pragma omp critical(inputs)
+    input_files[path] = hash;
+}
+
+void import_binary_float(std::string path, float * array, int n, bool hashed)
 {
     std::ifstream file(path, std::ios::in);
 
     if (!file.is_open())
         throw std::invalid_argument("Error: \033[31m" + path + "\033[0;0m could not be opened!");
-    
+
     file.read((char *) array, n * sizeof(float));
     
+    register_input(path, hashed ? hex(fnv1a((char *) array, file.gcount())) : "-");
+
     file.close();    
 }
 
@@ -43,50 +75,245 @@ void import_text_file(std::string path, std::vector<std::string> &elements)
     if (!file.is_open()) 
         throw std::invalid_argument("Error: \033[31m" + path + "\033[0;0m could not be opened!");
 
+    unsigned long long hash = 14695981039346656037ULL;
+
     std::string line;
     while(getline(file, line))
+    {
+        hash = fnv1a(line.data(), line.size(), hash);
+
         if (line[0] != '#') elements.push_back(line);
+    }
+
+    register_input(path, hex(hash));
 
     file.close();
 }
 
-std::string catch_parameter(std::string target, std::string file)
+static bool valid_value(std::string type, std::string value)
 {
-    char spaces = ' ';
-    char comment = '#';
+    size_t end = 0;
 
-    std::string line;
-    std::string variable;
+    try
+    {
+        if (type == "int") std::stoi(value, &end);
+        if (type == "float") std::stod(value, &end);
+    }
+    catch (const std::exception &) 
+    { 
+        return false; 
+    }
+
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+
+    if (type == "bool") return (value == "true") || (value == "false");
+
+    return (type != "int" && type != "float") || (end == value.size());
+}
+
+// modification time and size of a file, a library caller rewriting the parameters
+// between runs gets them parsed again
 
-    std::ifstream parameters(file);
+static std::string file_stamp(std::string file)
+{
+    struct stat info;
 
-    if (!parameters.is_open()) 
-        throw std::invalid_argument("Error: \033[31m" + file + "\033[0;0m could not be opened!");
+    if (stat(file.c_str(), &info) != 0) return "";
 
-    while (getline(parameters, line))
-    {           
-        if ((line.front() != comment) && (line.front() != spaces))        
+    return std::to_string(info.st_mtim.tv_sec) + "." + std::to_string(info.st_mtim.tv_nsec) + ":" + std::to_string(info.st_size);
+}
+
+std::map<std::string, Parameter> & parameter_registry(std::string file)
+{
+    static std::map<std::string, std::map<std::string, Parameter>> registry;
+    static std::map<std::string, std::string> stamps;
+
+    std::map<std::string, Parameter> * parameters;
+
+    std::string error;
+
+    // errors are raised outside the critical section, which must not be left by a throw
+
+    # pragma omp critical(parameters)
+    {
+        std::string stamp = file_stamp(file);
+
+        bool parsed = registry.count(file) && (stamps[file] == stamp);
+
+        parameters = &registry[file];
+
+        if (!parsed)
         {
-            if (line.find(target) == 0)
+            // keys read before the file changed stay in the resolved configuration
+
+            std::map<std::string, Parameter> previous;
+
+            previous.swap(*parameters);
+
+            stamps[file] = stamp;
+
+            std::ifstream input(file);
+
+            if (!input.is_open()) 
+                error = "Error: \033[31m" + file + "\033[0;0m could not be opened!";
+
+            std::string line;
+
+            for (int number = 1; error.empty() && getline(input, line); number++)
             {
-                for (int i = line.find("=")+2; i < line.size(); i++)
-                {    
-                    if (line[i] == '#') break;
-                    variable += line[i];            
-                }
+                size_t equal = line.find('=');
 
-                break;
+                if (line.empty() || (line.front() == '#') || (line.front() == ' ') || (line.find('#') < equal) || (equal == std::string::npos)) continue;
+
+                std::string comment = line.substr(std::min(line.find('#'), line.size()));
+
+                std::string key = line.substr(0, equal);
+                std::string value = line.substr(equal + 1, std::min(line.find('#'), line.size()) - equal - 1);
+
+                key.erase(remove(key.begin(), key.end(), ' '), key.end());
+                value.erase(remove(value.begin(), value.end(), ' '), value.end());
+
+                // the first definition wins, as with the former line scan
+
+                if (parameters->count(key)) continue;
+
+                Parameter parameter = {number, false, "", value};
+
+                for (std::string type : {"int", "float", "bool"})
+                    if (comment.find("<" + type + ">") != std::string::npos) parameter.type = type;
+
+                if (previous.count(key)) parameter.used = previous[key].used;
+
+                if (!valid_value(parameter.type, value))
+                    error = "Error: \033[31m" + key + "\033[0;0m in " + file + " (line " + std::to_string(number) + ") is not a valid <" + parameter.type + ">!";
+
+                (*parameters)[key] = parameter;
             }
-        }                 
+
+            input.close();
+
+            if (!error.empty()) 
+            {
+                registry.erase(file);
+                stamps.erase(file);
+            }
+        }
     }
-    
-    parameters.close();
 
-    variable.erase(remove(variable.begin(), variable.end(), ' '), variable.end());
+    if (!error.empty()) throw std::invalid_argument(error);
+
+    return *parameters;
+}
+
+std::string catch_parameter(std::string target, std::string file)
+{
+    std::map<std::string, Parameter> &parameters = parameter_registry(file);
+
+    std::string variable;
+
+    # pragma omp critical(parameters)
+    {
+        auto parameter = parameters.find(target);
+
+        if (parameter != parameters.end())
+        {
+            parameter->second.used = true;
+            variable = parameter->second.value;
+        }
+    }
 
     return variable;
 }
 
+std::string hash_file(std::string path)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+
+    if (!file.is_open()) return "";
+
+    std::vector<char> buffer(1 << 20);
+
+    unsigned long long hash = 14695981039346656037ULL;
+
+    while (file.read(buffer.data(), buffer.size()) || file.gcount())
+        hash = fnv1a(buffer.data(), file.gcount(), hash);
+
+    return hex(hash);
+}
+
+// contents of an input as the run saw it: the hash taken while reading when there is one,
+// the hashes of every input loaded from it for a folder, and the file on disk otherwise
+
+static std::string input_hash(std::string path)
+{
+    std::string hash;
+
+    struct stat info;
+
+    bool folder = (stat(path.c_str(), &info) == 0) && S_ISDIR(info.st_mode);
+
+    # pragma omp critical(inputs)
+    {
+        auto input = input_files.find(path);
+
+        if ((input != input_files.end()) && (input->second != "-")) 
+            hash = input->second;
+
+        else if (folder)
+            for (auto &loaded : input_files)
+                if ((loaded.first.compare(0, path.size(), path) == 0) && (loaded.second != "-"))
+                    hash += loaded.first.substr(path.size()) + ":" + loaded.second + ",";
+    }
+
+    return (hash.empty() && !folder) ? hash_file(path) : hash;
+}
+
+std::string hash_parameters(std::vector<std::string> targets, std::string file)
+{
+    // values naming a file or folder contribute the contents as well
+
+    std::string key;
+
+    for (auto target : targets)
+    {
+        std::string value = catch_parameter(target, file);
+
+        key += target + "=" + value + ":" + input_hash(value) + "\n";
+    }
+
+    return hex(fnv1a(key.data(), key.size()));
+}
+
+void export_configuration(std::string stage, std::string file)
+{
+    std::map<std::string, Parameter> &parameters = parameter_registry(file);
+
+    std::string resolved = "# resolved " + stage + " configuration of " + file + "\n";
+
+    for (auto &parameter : parameters)
+        if (parameter.second.used) resolved += parameter.first + " = " + parameter.second.value + "\n";
+
+    resolved += "\n# input files\n";
+
+    for (auto &input : input_files)
+        resolved += "# " + input.second + " " + input.first + "\n";
+
+    std::string hash = hex(fnv1a(resolved.data(), resolved.size()));
+
+    std::string path = file.substr(0, file.rfind('.')) + "_" + stage + "_resolved.txt";
+
+    std::ofstream output(path, std::ios::out);
+
+    if (!output.is_open()) 
+        throw std::invalid_argument("Error: \033[31m" + path + "\033[0;0m could not be opened!");
+
+    output << resolved << "\n# configuration hash " << hash << "\n";
+
+    output.close();
+
+    std::cout << "Configuration hash for " << stage << ": " << hash << " (" << path << ")" << std::endl;
+}
+
 std::vector<std::string> split(std::string s, char delimiter)
 {
     std::string token;
@@ -97,4 +324,18 @@ std::vector<std::string> split(std::string s, char delimiter)
         tokens.push_back(token);
    
     return tokens;
-}
\ No newline at end of file
+}
+
+double get_peak_memory()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss / 1024.0; // Linux reports kilobytes
+}
+
+void show_peak_memory(std::string stage)
+{
+    std::cout << "Peak resident memory after " << stage << ": " << get_peak_memory() << " MB" << std::endl;
+}
@@ -1,6 +1,7 @@
 # ifndef ADMIN_HPP
 # define ADMIN_HPP
 
+# include <map>
 # include <cmath>
 # include <chrono>
 # include <string>
@@ -10,17 +11,40 @@
 # include <iostream>
 # include <algorithm>
 
+# include <sys/stat.h>
 # include <sys/resource.h>
 
 bool str2bool(std::string s);
 
-void import_binary_float(std::string path, float * array, int n);
+void import_binary_float(std::string path, float * array, int n, bool hashed = false);
 void export_binary_float(std::string path, float * array, int n);
 
 void import_text_file(std::string path, std::vector<std::string> &elements);
 
+// parameter files are parsed and validated once, later lookups are served from memory
+// until the file changes on disk
+
+struct Parameter
+{
+    int line;
+    bool used;
+
+    std::string type;
+    std::string value;
+};
+
+std::map<std::string, Parameter> & parameter_registry(std::string file);
+
 std::string catch_parameter(std::string target, std::string file);
 
+std::string hash_file(std::string path);
+std::string hash_parameters(std::vector<std::string> targets, std::string file);
+
+void export_configuration(std::string stage, std::string file);
+
 std::vector<std::string> split(std::string s, char delimiter);
 
+double get_peak_memory();
+void show_peak_memory(std::string stage);
+
 # endif
\ No newline at end of file
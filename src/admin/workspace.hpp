@@ -0,0 +1,80 @@
+# ifndef WORKSPACE_HPP
+# define WORKSPACE_HPP
+
+# include <map>
+# include <string>
+# include <cstring>
+# include <algorithm>
+
+// Named scratch buffers owned by a solver. A buffer is allocated on first request
+// and only reallocated when a larger one is asked for, so repeated calls inside
+// shot or iteration loops reuse the same memory.
+
+class Workspace
+{
+private:
+
+    struct Buffer
+    {
+        char * data = nullptr;
+        size_t bytes = 0;
+    };
+
+    std::map<std::string, Buffer> buffers;
+
+    size_t current_bytes = 0;
+    size_t peak_bytes = 0;
+
+public:
+
+    Workspace() = default;
+
+    // cloned solvers start with an arena of their own
+
+    Workspace(const Workspace &) {}
+    Workspace & operator=(const Workspace &) { return *this; }
+
+    ~Workspace() { release(); }
+
+    template <typename type>
+    type * get(const std::string &name, size_t count, bool zero = true);
+
+    void release();
+
+    size_t high_water_mark() const { return peak_bytes; }
+};
+
+template <typename type>
+type * Workspace::get(const std::string &name, size_t count, bool zero)
+{
+    Buffer &buffer = buffers[name];
+
+    size_t bytes = count*sizeof(type);
+
+    if (bytes > buffer.bytes)
+    {
+        delete[] buffer.data;
+
+        current_bytes += bytes - buffer.bytes;
+        peak_bytes = std::max(peak_bytes, current_bytes);
+
+        buffer.data = new char[bytes];
+        buffer.bytes = bytes;
+    }
+
+    if (zero) std::memset(buffer.data, 0, bytes);
+
+    return reinterpret_cast<type *>(buffer.data);
+}
+
+inline void Workspace::release()
+{
+    for (auto &buffer : buffers)
+        delete[] buffer.second.data;
+
+    buffers.clear();
+
+    current_bytes = 0;
+}
+
+# endif
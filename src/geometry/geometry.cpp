@@ -1,5 +1,22 @@
 # include "geometry.hpp"
 
+Geometry::~Geometry()
+{
+    delete[] sInd;
+    delete[] iRec;
+    delete[] fRec;
+
+    delete[] spread;
+
+    delete[] xsrc;
+    delete[] ysrc;
+    delete[] zsrc;
+
+    delete[] xrec;
+    delete[] yrec;
+    delete[] zrec;
+}
+
 void Geometry::set_parameters()
 {    
     std::vector<std::string> SPS;
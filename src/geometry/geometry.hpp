@@ -27,6 +27,8 @@ public:
 
     std::string parameters;
 
+    ~Geometry();
+
     void set_parameters();     
 };
 
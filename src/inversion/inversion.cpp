@@ -2,6 +2,7 @@
 
 void Inversion::set_parameters()
 {
+    iteration = 0;
     max_iteration = std::stoi(catch_parameter("max_iteration", parameters));
 
     tk_order = std::stoi(catch_parameter("tk_order", parameters));
@@ -18,51 +19,417 @@ void Inversion::set_parameters()
 
     smooth_model_per_iteration = str2bool(catch_parameter("smooth_per_iteration", parameters));
 
+    checkpoint_folder = catch_parameter("checkpoint_folder", parameters);
+    checkpoint_frequency = std::stoi(catch_parameter("checkpoint_frequency", parameters));
+
+    resume_from_checkpoint = str2bool(catch_parameter("resume_from_checkpoint", parameters));
+    write_model_per_iteration = str2bool(catch_parameter("write_model_per_iteration", parameters));
+
+    batch_fraction = std::stof(catch_parameter("batch_fraction", parameters));
+    batch_growth = std::stof(catch_parameter("batch_growth", parameters));
+    batch_stratified = str2bool(catch_parameter("batch_stratified", parameters));
+
+    n_workers = std::stoi(catch_parameter("modeling_workers", parameters));
+
+    incremental_folder = catch_parameter("incremental_folder", parameters);
+    incremental_spill = str2bool(catch_parameter("incremental_spill", parameters));
+    incremental_modeling = str2bool(catch_parameter("incremental_modeling", parameters));
+    incremental_threshold = std::stof(catch_parameter("incremental_threshold", parameters));
+
     set_modeling_type();
+
+    // solvers with their own sequential forward modeling keep a single modeling object
+
+    if (!concurrent_modeling) n_workers = 1;
+
+    plan_memory();
+
+    set_modeling_workers();
+    set_incremental_modeling();
 }
 
-void Inversion::import_obsData()
+void Inversion::set_obsData()
 {
-    n_data = modeling->max_spread * modeling->geometry->nrel;
+    data_offset = new int[modeling->geometry->nrel + 1]();
+
+    for (int shot = 0; shot < modeling->geometry->nrel; shot++)
+        data_offset[shot + 1] = data_offset[shot] + modeling->geometry->spread[shot];
+
+    n_data = data_offset[modeling->geometry->nrel];
     n_model = modeling->nPoints;
 
     dcal = new float[n_data]();
     dobs = new float[n_data]();
 
-    for (modeling->srcId = 0; modeling->srcId < modeling->geometry->nrel; modeling->srcId++)
+    W = new float[n_data]();
+    R = new float[n_model]();
+}
+
+void Inversion::import_obsData()
+{
+    set_obsData();
+
+    // exceptions cannot leave an OpenMP region, the first one is rethrown after the loop
+
+    std::exception_ptr failure = nullptr;
+
+    # pragma omp parallel for
+    for (int shot = 0; shot < modeling->geometry->nrel; shot++)
     {
-        float * data = new float[modeling->max_spread]();
+        try
+        {
+            std::string path = obs_data_folder + obs_data_prefix + std::to_string(modeling->geometry->sInd[shot]+1) + ".bin";
+
+            import_binary_float(path, dobs + data_offset[shot], modeling->geometry->spread[shot]);
+        }
+        catch (...)
+        {
+            # pragma omp critical(obs_data)
+            if (!failure) failure = std::current_exception();
+        }
+    }
+
+    if (failure) std::rethrow_exception(failure);
+}
+
+Inversion::~Inversion()
+{
+    if (checkpoint_writer.joinable()) checkpoint_writer.join();
 
-        std::string path = obs_data_folder + obs_data_prefix + std::to_string(modeling->geometry->sInd[modeling->srcId]+1) + ".bin";
+    // the first worker is the solver itself, the others borrow its slowness and geometry
 
-        import_binary_float(path, data, modeling->max_spread);
+    for (int worker = 1; worker < workers.size(); worker++)
+        delete workers[worker];
 
-        int skipped = modeling->srcId * modeling->max_spread;    
-        
-        for (int i = 0; i < modeling->max_spread; i++) 
-            dobs[i + skipped] = data[i];
+    delete modeling;
 
-        delete[] data;
+    delete[] dcal;
+    delete[] dobs;
+    delete[] data_offset;
+
+    delete[] W;
+    delete[] R;
+    delete[] dS;
+
+    delete[] changed_at;
+    delete[] changed_near;
+    delete[] S_reference;
+
+    for (float * buffer : T_buffer) delete[] buffer;
+    for (float * buffer : T_previous) delete[] buffer;
+}
+
+float * Inversion::get_obsData(int &size)
+{
+    size = n_data;
+
+    return dobs;
+}
+
+Modeling * Inversion::get_modeling()
+{
+    return modeling;
+}
+
+void Inversion::select_shot_batch()
+{
+    int nrel = modeling->geometry->nrel;
+
+    int batch_size = (int)ceilf(nrel * batch_fraction * powf(batch_growth, iteration));
+
+    if (iteration == max_iteration) batch_size = nrel;
+
+    batch_size = std::max(1, std::min(nrel, batch_size));
+
+    batch.resize(batch_size);
+
+    if (batch_size == nrel)
+    {
+        for (int shot = 0; shot < nrel; shot++) 
+            batch[shot] = shot;
+
+        return;
     }
 
-    W = new float[n_data]();
-    R = new float[n_model]();
+    std::mt19937 generator(iteration + 1);
+
+    if (batch_stratified)
+    {
+        std::uniform_real_distribution<float> position(0.0f, 1.0f);
+
+        for (int stratum = 0; stratum < batch_size; stratum++)
+            batch[stratum] = std::min(nrel - 1, (int)((stratum + position(generator)) * nrel / batch_size));
+    }
+    else
+    {
+        std::vector<int> shots(nrel);
+
+        for (int shot = 0; shot < nrel; shot++) 
+            shots[shot] = shot;
+
+        std::shuffle(shots.begin(), shots.end(), generator);
+
+        std::copy(shots.begin(), shots.begin() + batch_size, batch.begin());
+
+        std::sort(batch.begin(), batch.end());
+    }
 }
 
 void Inversion::forward_modeling()
 {
-    for (modeling->srcId = 0; modeling->srcId < modeling->geometry->nrel; modeling->srcId++)
+    select_shot_batch();
+
+    update_changed_region();
+
+    iG_batch.resize(batch.size());
+    jG_batch.resize(batch.size());
+    vG_batch.resize(batch.size());
+
+    for (int worker = 1; worker < workers.size(); worker++)
+        modeling->update_worker(workers[worker]);
+
+    // spill reads and writes may throw inside the region, the first exception is rethrown after it
+
+    std::exception_ptr failure = nullptr;
+
+    # pragma omp parallel for schedule(dynamic) num_threads(workers.size()) if(workers.size() > 1)
+    for (int shot = 0; shot < batch.size(); shot++)
     {
-        modeling->set_shot_point();
-        
-        show_information();
+        int worker_id = omp_get_thread_num();
 
-        modeling->time_propagation();
-        
-        concatenate_data();
-        
+        Modeling * worker = workers[worker_id];
+
+        try
+        {
+            worker->srcId = batch[shot];
+
+            worker->set_shot_point();
+            
+            if (worker_id == 0) show_information();
+
+            std::vector< int >().swap(iG_batch[shot]);
+            std::vector< int >().swap(jG_batch[shot]);
+            std::vector<float>().swap(vG_batch[shot]);
+
+            if (reuse_previous_shot(worker, shot)) continue;
+
+            worker->time_propagation();
+            
+            concatenate_data(worker);
+            
+            if (iteration != max_iteration)
+                gradient_ray_tracing(worker, shot);
+
+            store_previous_shot(worker, shot);
+        }
+        catch (...)
+        {
+            # pragma omp critical(forward_modeling)
+            if (!failure) failure = std::current_exception();
+        }
+    }
+
+    if (failure) std::rethrow_exception(failure);
+
+    for (int shot = 0; shot < batch.size(); shot++)
+    {
+        iG.insert(iG.end(), iG_batch[shot].begin(), iG_batch[shot].end());
+        jG.insert(jG.end(), jG_batch[shot].begin(), jG_batch[shot].end());
+        vG.insert(vG.end(), vG_batch[shot].begin(), vG_batch[shot].end());
+    }
+}
+
+void Inversion::plan_memory()
+{
+    int nrel = modeling->geometry->nrel;
+
+    double traces = 0.0;
+    for (int shot = 0; shot < nrel; shot++)
+        traces += modeling->geometry->spread[shot];
+
+    double volume = modeling->volsize*sizeof(float);
+
+    // a ray crosses at most one voxel per grid line between source and receiver
+
+    double ray_entries = traces*(modeling->nx + modeling->ny + modeling->nz);
+
+    // iG, jG and vG take 4 + 4 + 4 bytes per entry. The rows are kept per shot and once more
+    // concatenated, and the last iteration is a full pass, so the largest batch holds every ray.
+
+    double row_bytes = (sizeof(int) + sizeof(int) + sizeof(float))*ray_entries;
+
+    double model_bytes = modeling->host_bytes;
+    double device_bytes = modeling->device_bytes;
+
+    auto estimate = [&]()
+    {
+        modeling->host_bytes = model_bytes + 4.0*traces*sizeof(float) + 3.0*modeling->nPoints*sizeof(float);
+
+        modeling->host_bytes += 2.0*row_bytes + (n_workers - 1)*(volume + modeling->max_spread*sizeof(float));
+
+        if (incremental_modeling)
+            modeling->host_bytes += (n_workers + 1)*volume + 2.0*modeling->volsize*sizeof(int) + row_bytes + (incremental_spill ? 0.0 : nrel*volume);
+
+        modeling->device_bytes = device_bytes + 2.0*(n_workers - 1)*volume;
+    };
+
+    estimate();
+
+    // trade concurrency and resident travel times for memory before refusing the run
+
+    while (!modeling->fits_memory_budget() && (n_workers > 1))
+    {
+        n_workers--;
+        estimate();
+    }
+
+    if (!modeling->fits_memory_budget() && incremental_modeling && !incremental_spill)
+    {
+        incremental_spill = true;
+        estimate();
+    }
+
+    std::cout << "Memory plan: " << n_workers << " modeling workers, incremental spill " << (incremental_spill ? "on" : "off") << std::endl;
+
+    modeling->check_memory_budget(inversion_name);
+}
+
+void Inversion::set_modeling_workers()
+{
+    workers.push_back(modeling);
+
+    for (int worker = 1; worker < n_workers; worker++)
+        workers.push_back(modeling->create_worker());
+}
+
+void Inversion::set_incremental_modeling()
+{
+    incremental_modeling = incremental_modeling && (modeling->modeling_type == "eikonal_iso");
+
+    if (!incremental_modeling) return;
+
+    int nrel = modeling->geometry->nrel;
+
+    solved_at.assign(nrel, -1);
+    T_previous.assign(nrel, nullptr);
+
+    iG_previous.resize(nrel);
+    jG_previous.resize(nrel);
+    vG_previous.resize(nrel);
+
+    changed_at = new int[modeling->volsize]();
+    changed_near = new int[modeling->volsize]();
+    for (int worker = 0; worker < n_workers; worker++)
+        T_buffer.push_back(new float[modeling->volsize]());
+    S_reference = new float[modeling->volsize]();
+
+    std::copy(modeling->S, modeling->S + modeling->volsize, S_reference);
+}
+
+void Inversion::update_changed_region()
+{
+    if (!incremental_modeling) return;
+
+    # pragma omp parallel for
+    for (int index = 0; index < modeling->volsize; index++)
+    {
+        if (fabsf(modeling->S[index] - S_reference[index]) > incremental_threshold*fabsf(S_reference[index]))
+        {
+            changed_at[index] = iteration;
+            S_reference[index] = modeling->S[index];
+        }
+    }
+
+    // the sweep stencil reads times one cell around a changed slowness, so the mask is dilated by one cell
+
+    int nxx = modeling->nxx;
+    int nyy = modeling->nyy;
+    int nzz = modeling->nzz;
+
+    # pragma omp parallel for collapse(2)
+    for (int k = 0; k < nyy; k++)
+    {
+        for (int j = 0; j < nxx; j++)
+        {
+            for (int i = 0; i < nzz; i++)
+            {
+                int latest = 0;
+
+                for (int nk = std::max(k - 1, 0); nk <= std::min(k + 1, nyy - 1); nk++)
+                    for (int nj = std::max(j - 1, 0); nj <= std::min(j + 1, nxx - 1); nj++)
+                        for (int ni = std::max(i - 1, 0); ni <= std::min(i + 1, nzz - 1); ni++)
+                            latest = std::max(latest, changed_at[ni + nj*nzz + nk*nxx*nzz]);
+
+                changed_near[i + j*nzz + k*nxx*nzz] = latest;
+            }
+        }
+    }
+}
+
+bool Inversion::reuse_previous_shot(Modeling * worker, int shot)
+{
+    if (!incremental_modeling || (solved_at[worker->srcId] < 0)) return false;
+
+    float * T = T_previous[worker->srcId];
+
+    if (incremental_spill)
+    {
+        import_binary_float(incremental_folder + inversion_name + "_previous_times_shot_" + std::to_string(worker->srcId+1) + ".bin", T_buffer[omp_get_thread_num()], modeling->volsize);
+
+        T = T_buffer[omp_get_thread_num()];
+    }
+
+    float reset_time = 1e6f;
+
+    int last_solve = solved_at[worker->srcId];
+
+    # pragma omp parallel for reduction(min:reset_time)
+    for (int index = 0; index < modeling->volsize; index++)
+        if (changed_near[index] > last_solve) reset_time = std::min(reset_time, T[index]);
+
+    float last_pick = 0.0f;
+
+    for (int i = data_offset[worker->srcId]; i < data_offset[worker->srcId + 1]; i++)
+        last_pick = std::max(last_pick, dcal[i]);
+
+    if (reset_time > last_pick)
+    {
         if (iteration != max_iteration)
-            gradient_ray_tracing();
+        {
+            iG_batch[shot] = iG_previous[worker->srcId];
+            jG_batch[shot] = jG_previous[worker->srcId];
+            vG_batch[shot] = vG_previous[worker->srcId];
+        }
+
+        return true;
+    }
+
+    worker->set_warm_start(T, reset_time);
+
+    return false;
+}
+
+void Inversion::store_previous_shot(Modeling * worker, int shot)
+{
+    if (!incremental_modeling) return;
+
+    solved_at[worker->srcId] = iteration;
+
+    if (incremental_spill)
+        export_binary_float(incremental_folder + inversion_name + "_previous_times_shot_" + std::to_string(worker->srcId+1) + ".bin", worker->T, modeling->volsize);
+    else
+    {
+        if (T_previous[worker->srcId] == nullptr) 
+            T_previous[worker->srcId] = new float[modeling->volsize]();
+
+        std::copy(worker->T, worker->T + modeling->volsize, T_previous[worker->srcId]);
+    }
+
+    if (iteration != max_iteration)
+    {
+        iG_previous[worker->srcId] = iG_batch[shot];
+        jG_previous[worker->srcId] = jG_batch[shot];
+        vG_previous[worker->srcId] = vG_batch[shot];
     }
 }
 
@@ -79,48 +446,53 @@ void Inversion::show_information()
         std::cout << "-------- Computing iteration " << iteration + 1 << " of " << max_iteration << " --------\n\n";
 
         if (iteration > 0) std::cout << "Previous residuo: " << residuo.back() << "\n\n";   
+
+        if (batch.size() < modeling->geometry->nrel) 
+            std::cout << "Shot batch: " << batch.size() << " of " << modeling->geometry->nrel << " shots\n\n";
     }
 }
 
-void Inversion::concatenate_data()
+void Inversion::concatenate_data(Modeling * worker)
 {
-    modeling->compute_seismogram();
+    worker->compute_seismogram();
 
-    int skipped = modeling->srcId * modeling->max_spread;
+    int skipped = data_offset[worker->srcId];
 
-    for (int i = 0; i < modeling->max_spread; i++) 
-        dcal[i + skipped] = modeling->seismogram[i];    
+    for (int i = 0; i < worker->geometry->spread[worker->srcId]; i++) 
+        dcal[i + skipped] = worker->seismogram[i];    
 }
 
-void Inversion::gradient_ray_tracing()
+void Inversion::gradient_ray_tracing(Modeling * worker, int shot)
 {
-    int sIdx = (int)((modeling->sx + 0.5f*modeling->dx) / modeling->dx);
-    int sIdy = (int)((modeling->sy + 0.5f*modeling->dy) / modeling->dy);
-    int sIdz = (int)((modeling->sz + 0.5f*modeling->dz) / modeling->dz);
+    int sIdx = (int)((worker->sx + 0.5f*worker->dx) / worker->dx);
+    int sIdy = (int)((worker->sy + 0.5f*worker->dy) / worker->dy);
+    int sIdz = (int)((worker->sz + 0.5f*worker->dz) / worker->dz);
 
-    int sId = sIdz + sIdx*modeling->nz + sIdy*modeling->nx*modeling->nz; 
+    int sId = sIdz + sIdx*worker->nz + sIdy*worker->nx*worker->nz; 
 
-    float rayStep = 0.2f*modeling->dz;
+    float rayStep = 0.2f*worker->dz;
+
+    int skipped = data_offset[worker->srcId] - worker->geometry->iRec[worker->srcId];
 
     std::vector<int> ray_index; 
 
-    for (int ray_id = modeling->geometry->iRec[modeling->srcId]; ray_id < modeling->geometry->fRec[modeling->srcId]; ray_id++)
+    for (int ray_id = worker->geometry->iRec[worker->srcId]; ray_id < worker->geometry->fRec[worker->srcId]; ray_id++)
     {
-        float xi = modeling->geometry->xrec[ray_id];        
-        float yi = modeling->geometry->yrec[ray_id];        
-        float zi = modeling->geometry->zrec[ray_id];
+        float xi = worker->geometry->xrec[ray_id];        
+        float yi = worker->geometry->yrec[ray_id];        
+        float zi = worker->geometry->zrec[ray_id];
 
-        if ((modeling->sz == zi) && (modeling->sx == xi) && (modeling->sy == zi)) continue;        
+        if ((worker->sz == zi) && (worker->sx == xi) && (worker->sy == zi)) continue;        
 
         while (true)
         {
-            int k = (int)((yi + 0.5f*modeling->dy) / modeling->dy) + modeling->nb; 
-            int j = (int)((xi + 0.5f*modeling->dx) / modeling->dx) + modeling->nb; 
-            int i = (int)((zi + 0.5f*modeling->dz) / modeling->dz) + modeling->nb; 
+            int k = (int)((yi + 0.5f*worker->dy) / worker->dy) + worker->nb; 
+            int j = (int)((xi + 0.5f*worker->dx) / worker->dx) + worker->nb; 
+            int i = (int)((zi + 0.5f*worker->dz) / worker->dz) + worker->nb; 
 
-            float dTz = 0.5f*(modeling->T[(i+1) + j*modeling->nzz + k*modeling->nxx*modeling->nzz] - modeling->T[(i-1) + j*modeling->nzz + k*modeling->nxx*modeling->nzz]) / modeling->dz;    
-            float dTx = 0.5f*(modeling->T[i + (j+1)*modeling->nzz + k*modeling->nxx*modeling->nzz] - modeling->T[i + (j-1)*modeling->nzz + k*modeling->nxx*modeling->nzz]) / modeling->dx;    
-            float dTy = 0.5f*(modeling->T[i + j*modeling->nzz + (k+1)*modeling->nxx*modeling->nzz] - modeling->T[i + j*modeling->nzz + (k-1)*modeling->nxx*modeling->nzz]) / modeling->dy;    
+            float dTz = 0.5f*(worker->T[(i+1) + j*worker->nzz + k*worker->nxx*worker->nzz] - worker->T[(i-1) + j*worker->nzz + k*worker->nxx*worker->nzz]) / worker->dz;    
+            float dTx = 0.5f*(worker->T[i + (j+1)*worker->nzz + k*worker->nxx*worker->nzz] - worker->T[i + (j-1)*worker->nzz + k*worker->nxx*worker->nzz]) / worker->dx;    
+            float dTy = 0.5f*(worker->T[i + j*worker->nzz + (k+1)*worker->nxx*worker->nzz] - worker->T[i + j*worker->nzz + (k-1)*worker->nxx*worker->nzz]) / worker->dy;    
 
             float norm = sqrtf(dTx*dTx + dTy*dTy + dTz*dTz);
 
@@ -128,20 +500,20 @@ void Inversion::gradient_ray_tracing()
             yi -= rayStep*dTy / norm;   
             zi -= rayStep*dTz / norm;    
 
-            int km = (int)((yi + 0.5f*modeling->dy) / modeling->dy); 
-            int jm = (int)((xi + 0.5f*modeling->dx) / modeling->dx); 
-            int im = (int)((zi + 0.5f*modeling->dz) / modeling->dz); 
+            int km = (int)((yi + 0.5f*worker->dy) / worker->dy); 
+            int jm = (int)((xi + 0.5f*worker->dx) / worker->dx); 
+            int im = (int)((zi + 0.5f*worker->dz) / worker->dz); 
             
-            int index = im + jm*modeling->nz + km*modeling->nx*modeling->nz;
+            int index = im + jm*worker->nz + km*worker->nx*worker->nz;
 
             ray_index.push_back(index);
 
             if (ray_index.back() == sId) break;
         }
    
-        float final_distance = sqrtf(powf(zi - modeling->sz, 2.0f) + 
-                                     powf(xi - modeling->sx, 2.0f) + 
-                                     powf(yi - modeling->sy, 2.0f));
+        float final_distance = sqrtf(powf(zi - worker->sz, 2.0f) + 
+                                     powf(xi - worker->sx, 2.0f) + 
+                                     powf(yi - worker->sy, 2.0f));
 
         std::sort(ray_index.begin(), ray_index.end());
 
@@ -156,11 +528,11 @@ void Inversion::gradient_ray_tracing()
             }
             else
             {
-                vG.push_back(distance_per_voxel);
-                jG.push_back(current_voxel_index);
-                iG.push_back(ray_id + modeling->srcId * modeling->max_spread);
+                vG_batch[shot].push_back(distance_per_voxel);
+                jG_batch[shot].push_back(current_voxel_index);
+                iG_batch[shot].push_back(ray_id + skipped);
 
-                if (current_voxel_index == sId) vG.back() = final_distance;
+                if (current_voxel_index == sId) vG_batch[shot].back() = final_distance;
 
                 distance_per_voxel = rayStep;
                 current_voxel_index = ray_index[index];    
@@ -169,29 +541,50 @@ void Inversion::gradient_ray_tracing()
 
         if (current_voxel_index == sId)
         {
-            vG.push_back(final_distance);
-            jG.push_back(current_voxel_index);
-            iG.push_back(ray_id + modeling->srcId * modeling->max_spread);
+            vG_batch[shot].push_back(final_distance);
+            jG_batch[shot].push_back(current_voxel_index);
+            iG_batch[shot].push_back(ray_id + skipped);
         }
         else 
         {
-            vG.push_back(distance_per_voxel);
-            jG.push_back(current_voxel_index);
-            iG.push_back(ray_id + modeling->srcId * modeling->max_spread);
+            vG_batch[shot].push_back(distance_per_voxel);
+            jG_batch[shot].push_back(current_voxel_index);
+            iG_batch[shot].push_back(ray_id + skipped);
         }
 
-        std::vector<int>().swap(ray_index);
+        ray_index.clear();
     }
 }
 
-void Inversion::check_convergence()
+int Inversion::batch_picks()
+{
+    int picks = 0;
+
+    for (int shot = 0; shot < batch.size(); shot++)
+        picks += data_offset[batch[shot] + 1] - data_offset[batch[shot]];
+
+    return std::max(picks, 1);
+}
+
+// batches grow between iterations, the RMS over the picks of the batch keeps the history comparable
+
+float Inversion::batch_rms()
 {
     float square_difference = 0.0f;
     
-    for (int i = 0; i < n_data; i++)
-        square_difference += powf(dobs[i] - dcal[i], 2.0f);
-    
-    residuo.push_back(sqrtf(square_difference));
+    # pragma omp parallel for reduction(+:square_difference)
+    for (int shot = 0; shot < batch.size(); shot++)
+    {
+        for (int i = data_offset[batch[shot]]; i < data_offset[batch[shot] + 1]; i++)
+            square_difference += powf(dobs[i] - dcal[i], 2.0f);
+    }
+
+    return sqrtf(square_difference / batch_picks());
+}
+
+void Inversion::check_convergence()
+{
+    residuo.push_back(batch_rms());
 
     if ((iteration >= max_iteration))
     {
@@ -221,9 +614,9 @@ void Inversion::set_regularization_matrix()
     int n = n_model - tk_order;
     int nnz = (tk_order + 1) * (n_model - tk_order);	
     
-    iR = new int[nnz]();
-    jR = new int[nnz]();
-    vR = new float[nnz]();
+    iR = workspace.get<int>("iR", nnz);
+    jR = workspace.get<int>("jR", nnz);
+    vR = workspace.get<float>("vR", nnz);
 
     if (tk_order <= 0)
     {
@@ -274,10 +667,10 @@ void Inversion::solve_linear_system_lscg()
     float a, b, qTq, rTr, rd;
     int cg_max_iteration = 10;
 
-    float * s = new float[N]();
-    float * q = new float[N]();
-    float * r = new float[M]();
-    float * p = new float[M]();
+    float * s = workspace.get<float>("cg_s", N);
+    float * q = workspace.get<float>("cg_q", N);
+    float * r = workspace.get<float>("cg_r", M);
+    float * p = workspace.get<float>("cg_p", M);
 
     for (int i = 0; i < N; i++) 
         s[i] = B[i]; 
@@ -339,17 +732,6 @@ void Inversion::solve_linear_system_lscg()
     }
 
     get_parameter_variation();
-
-    delete[] s;
-    delete[] q;
-    delete[] r;
-    delete[] p;
-
-    delete[] iA;
-    delete[] jA;
-    delete[] vA;
-    delete[] B;
-    delete[] x;
 }
 
 void Inversion::model_smoothing(float * model)
@@ -361,6 +743,9 @@ void Inversion::model_smoothing(float * model)
         int aux_nz = modeling->nz + 2*smoother_samples;
 
         int aux_nPoints = aux_nx*aux_ny*aux_nz;
+
+        float * dm_aux = workspace.get<float>("smooth_input", aux_nPoints);
+        float * dm_smooth = workspace.get<float>("smooth_output", aux_nPoints, false);
     
         # pragma omp parallel for
         for (int index = 0; index < modeling->nPoints; index++)
@@ -387,9 +772,6 @@ void Inversion::model_smoothing(float * model)
 
             model[i + j*modeling->nz + k*modeling->nx*modeling->nz] = dm_smooth[ind_filt];
         }
-      
-        delete[] dm_aux;
-        delete[] dm_smooth;
     }
 }        
 
@@ -398,7 +780,7 @@ void Inversion::smooth_volume(float * input, float * output, int nx, int ny, int
     int nPoints = nx * ny * nz;
     int nKernel = smoother_samples * smoother_samples * smoother_samples;
 
-    float * kernel = new float[nKernel]();
+    float * kernel = workspace.get<float>("smooth_kernel", nKernel);
 
     # pragma omp parallel for
     for (int i = 0; i < nPoints; i++) 
@@ -459,16 +841,134 @@ void Inversion::smooth_volume(float * input, float * output, int nx, int ny, int
             }
         }   
     }
+}
 
-    delete[] kernel;
+void Inversion::refresh_device_models()
+{
+    modeling->copy_slowness_to_device();
+}
+
+void Inversion::import_checkpoint()
+{
+    if (!resume_from_checkpoint) return;
+
+    std::string checkpoint_path = checkpoint_folder + inversion_name + "_checkpoint.bin";
+
+    std::ifstream file(checkpoint_path, std::ios::in | std::ios::binary);
+
+    if (!file.is_open())
+        throw std::invalid_argument("Error: \033[31m" + checkpoint_path + "\033[0;0m could not be opened!");
+
+    int header[4];
+
+    file.read((char *) header, 4*sizeof(int));
+
+    if ((header[2] != modeling->volsize) || (header[3] != (int)checkpoint_models.size()))
+        throw std::invalid_argument("Error: \033[31m" + checkpoint_path + "\033[0;0m does not match the current inversion setup!");
+
+    iteration = header[0];
+
+    residuo.resize(header[1]);
+
+    file.read((char *) residuo.data(), header[1]*sizeof(float));
+    file.read((char *) modeling->S, modeling->volsize*sizeof(float));
+
+    for (int m = 0; m < checkpoint_models.size(); m++)
+        file.read((char *) checkpoint_models[m], modeling->nPoints*sizeof(float));
+
+    file.close();
+
+    refresh_device_models();
+
+    std::cout << "Resuming \033[34m" << inversion_name << "\033[0;0m from iteration " << iteration << std::endl;
+}
+
+void Inversion::export_checkpoint()
+{
+    bool checkpoint = (checkpoint_frequency > 0) && (iteration % checkpoint_frequency == 0);
+
+    if (!checkpoint && !write_model_per_iteration) return;
+
+    if (checkpoint_writer.joinable()) checkpoint_writer.join();
+
+    int residuo_size = residuo.size();
+    int model_size = modeling->volsize + checkpoint_models.size()*modeling->nPoints;
+
+    checkpoint_buffer.resize(residuo_size + model_size + modeling->nPoints);
+
+    float * buffer = checkpoint_buffer.data();
+
+    std::copy(residuo.begin(), residuo.end(), buffer);
+
+    std::copy(modeling->S, modeling->S + modeling->volsize, buffer + residuo_size);
+
+    for (int m = 0; m < checkpoint_models.size(); m++)
+        std::copy(checkpoint_models[m], checkpoint_models[m] + modeling->nPoints, buffer + residuo_size + modeling->volsize + m*modeling->nPoints);
+
+    float * Vp = buffer + residuo_size + model_size;
+
+    modeling->reduce_boundary(modeling->S, Vp);
+
+    # pragma omp parallel for
+    for (int index = 0; index < modeling->nPoints; index++)
+        Vp[index] = 1.0f / Vp[index];
+
+    checkpoint_writer = std::thread(&Inversion::write_checkpoint, this, iteration, residuo_size);
+}
+
+void Inversion::write_checkpoint(int current_iteration, int residuo_size)
+{
+    float * buffer = checkpoint_buffer.data();
+
+    int model_size = modeling->volsize + checkpoint_models.size()*modeling->nPoints;
+
+    if (write_model_per_iteration)
+    {
+        std::string snapshot_path = estimated_model_folder + inversion_name + "_model_vp_iteration_" + std::to_string(current_iteration) + "_" + std::to_string(modeling->nz) + "x" + std::to_string(modeling->nx) + "x" + std::to_string(modeling->ny) + ".bin";
+
+        std::ofstream snapshot(snapshot_path, std::ios::out | std::ios::binary);
+
+        if (!snapshot.is_open())
+            std::cerr << "Error: \033[31m" << snapshot_path << "\033[0;0m could not be opened!" << std::endl;
+        else
+        {
+            snapshot.write((char *)(buffer + residuo_size + model_size), modeling->nPoints*sizeof(float));
+            snapshot.close();
+        }
+    }
+
+    if ((checkpoint_frequency > 0) && (current_iteration % checkpoint_frequency == 0))
+    {
+        std::string checkpoint_path = checkpoint_folder + inversion_name + "_checkpoint.bin";
+
+        int header[4] = {current_iteration, residuo_size, modeling->volsize, (int)checkpoint_models.size()};
+
+        std::ofstream file(checkpoint_path + ".tmp", std::ios::out | std::ios::binary);
+
+        if (!file.is_open())
+        {
+            std::cerr << "Error: \033[31m" << checkpoint_path << "\033[0;0m could not be opened!" << std::endl;
+            return;
+        }
+
+        file.write((char *) header, 4*sizeof(int));
+        file.write((char *) buffer, (residuo_size + model_size)*sizeof(float));
+        file.close();
+
+        std::rename((checkpoint_path + ".tmp").c_str(), checkpoint_path.c_str());
+    }
 }
 
 void Inversion::export_results()
 {    
+    if (checkpoint_writer.joinable()) checkpoint_writer.join();
+
     std::string estimated_model_path = estimated_model_folder + inversion_name + "_final_model_" + std::to_string(modeling->nz) + "x" + std::to_string(modeling->nx) + "x" + std::to_string(modeling->ny) + ".bin";
 
     export_estimated_models();
 
+    std::string convergence_map_path = convergence_map_folder + inversion_name + "_convergence_" + std::to_string(residuo.size()) + "_iterations.txt"; 
+
     std::ofstream resFile(convergence_map_path, std::ios::out);
     
     for (int r = 0; r < residuo.size(); r++) 
@@ -477,4 +977,6 @@ void Inversion::export_results()
     resFile.close();
 
     std::cout << "Text file \033[34m" << convergence_map_path << "\033[0;0m was successfully written." << std::endl;
+
+    std::cout << "Workspace high-water mark: " << (workspace.high_water_mark() + modeling->workspace.high_water_mark()) / 1e6 << " MB" << std::endl;
 }
@@ -4,6 +4,12 @@
 # include "../modeling/eikonal_iso.cuh"
 # include "../modeling/eikonal_ani.cuh"
 
+# include <omp.h>
+# include <cstdio>
+# include <random>
+# include <exception>
+# include <thread>
+
 class Inversion
 {
 private:
@@ -16,15 +22,64 @@ private:
     std::string obs_data_prefix;
     std::string convergence_map_folder;
 
+    int n_workers;
+    int checkpoint_frequency;
+
+    std::vector<Modeling *> workers;
+
+    std::vector<std::vector< int >> iG_batch;
+    std::vector<std::vector< int >> jG_batch;
+    std::vector<std::vector<float>> vG_batch;
+
+    float batch_fraction;
+    float batch_growth;
+    
+    bool batch_stratified;
+
+    bool incremental_modeling;
+    bool incremental_spill;
+
+    float incremental_threshold;
+
+    std::string incremental_folder;
+
+    int * changed_at = nullptr;
+    int * changed_near = nullptr;
+
+    float * S_reference = nullptr;
+
+    std::vector<float *> T_buffer;
+
+    std::vector<int> solved_at;
+    std::vector<float *> T_previous;
+
+    std::vector<std::vector< int >> iG_previous;
+    std::vector<std::vector< int >> jG_previous;
+    std::vector<std::vector<float>> vG_previous;
+
+    bool resume_from_checkpoint;
     bool write_model_per_iteration;
     bool smooth_model_per_iteration;
 
-    void show_information();
-    void concatenate_data();
-    void gradient_ray_tracing();
+    std::string checkpoint_folder;
+
+    std::thread checkpoint_writer;
+
+    std::vector<float> checkpoint_buffer;
+
+    void gradient_ray_tracing(Modeling * worker, int shot);
     void solve_linear_system_lscg();
     void set_regularization_matrix();
 
+    void plan_memory();
+    void set_modeling_workers();
+    void set_incremental_modeling();
+    void update_changed_region();
+    void store_previous_shot(Modeling * worker, int shot);
+    bool reuse_previous_shot(Modeling * worker, int shot);
+
+    void write_checkpoint(int current_iteration, int residuo_size);
+
 protected:
 
     int n_data;
@@ -39,6 +94,8 @@ protected:
     float * dcal = nullptr;
     float * dobs = nullptr;
 
+    int * data_offset = nullptr;
+
     int M, N, NNZ;
 
     int * iA = nullptr;
@@ -63,8 +120,16 @@ protected:
 
     Modeling * modeling = nullptr;
 
+    bool concurrent_modeling = true;
+
+    std::vector<float *> checkpoint_models;
+
     std::vector<float> residuo;
 
+    std::vector<int> batch;
+
+    Workspace workspace;
+
     std::string inversion_name;
     std::string inversion_method;
     std::string estimated_model_folder;
@@ -74,6 +139,15 @@ protected:
     virtual void get_parameter_variation() = 0;
     virtual void export_estimated_models() = 0;
 
+    void show_information();
+    void concatenate_data(Modeling * worker);
+    void select_shot_batch();
+
+    int batch_picks();
+    float batch_rms();
+
+    virtual void refresh_device_models();
+
     void model_smoothing(float * model);
     void smooth_volume(float * input, float * output, int nx, int ny, int nz);
 
@@ -83,17 +157,27 @@ public:
 
     std::string parameters;
 
+    virtual ~Inversion();
+
     void set_parameters();
+    void set_obsData();
     void import_obsData();
 
-    void forward_modeling();
+    virtual void forward_modeling();
     void check_convergence();
 
-    void optimization();
+    virtual void optimization();
     
     virtual void model_update() = 0;
 
+    void import_checkpoint();
+    void export_checkpoint();
+
     void export_results();
+
+    float * get_obsData(int &size);
+
+    Modeling * get_modeling();
 };
 
 # endif
\ No newline at end of file
@@ -0,0 +1,383 @@
+# include "tomography_adj.cuh"
+
+void Tomography_ADJ::set_modeling_type()
+{
+    modeling = new Eikonal_ISO();
+    modeling->parameters = parameters;
+    modeling->set_parameters();
+
+    if (modeling->domain_decomposition)
+        throw std::invalid_argument("Error: \033[31mdomain decomposition\033[0;0m needs the full travel time volume on the device for the adjoint-state tomography!");
+
+    inversion_name = "tomography_adj";
+    inversion_method = "Adjoint-state First-Arrival Tomography";
+
+    // the adjoint solve reuses the main device buffers shot after shot, workers would sit idle
+
+    concurrent_modeling = false;
+
+    max_variation = std::stof(catch_parameter("max_slowness_variation", parameters));
+    max_backtracks = std::stoi(catch_parameter("max_backtracks", parameters));
+
+    dS = new float[modeling->nPoints]();
+
+    gradient = new float[modeling->nPoints]();
+    gradient_old = new float[modeling->nPoints]();
+    direction = new float[modeling->nPoints]();
+
+    checkpoint_models = {gradient_old, direction};
+
+    h_G = new float[modeling->volsize]();
+
+    h_rIdx = new int[modeling->max_spread]();
+    h_rVal = new float[modeling->max_spread]();
+
+    cudaMalloc((void**)&(d_L), modeling->volsize*sizeof(float));
+    cudaMalloc((void**)&(d_R), modeling->volsize*sizeof(float));
+    cudaMalloc((void**)&(d_G), modeling->volsize*sizeof(float));
+
+    cudaMalloc((void**)&(d_rIdx), modeling->max_spread*sizeof(int));
+    cudaMalloc((void**)&(d_rVal), modeling->max_spread*sizeof(float));
+
+    nThreads = 256;
+    nBlocks = (int)((modeling->volsize + nThreads - 1) / nThreads);
+}
+
+Tomography_ADJ::~Tomography_ADJ()
+{
+    delete[] h_rIdx;
+    delete[] h_rVal;
+    delete[] h_G;
+
+    delete[] gradient;
+    delete[] gradient_old;
+    delete[] direction;
+
+    cudaFree(d_rIdx);
+    cudaFree(d_rVal);
+
+    cudaFree(d_L);
+    cudaFree(d_R);
+    cudaFree(d_G);
+}
+
+void Tomography_ADJ::forward_modeling()
+{
+    cudaMemset(d_G, 0, modeling->volsize*sizeof(float));
+
+    select_shot_batch();
+
+    for (int shot = 0; shot < batch.size(); shot++)
+    {
+        modeling->srcId = batch[shot];
+
+        modeling->set_shot_point();
+
+        show_information();
+
+        modeling->time_propagation();
+
+        concatenate_data(modeling);
+
+        if (iteration != max_iteration)
+            adjoint_solver();
+    }
+}
+
+void Tomography_ADJ::adjoint_initialization()
+{
+    int spread = 0;
+
+    int skipped = data_offset[modeling->srcId];
+
+    for (int recId = modeling->geometry->iRec[modeling->srcId]; recId < modeling->geometry->fRec[modeling->srcId]; recId++)
+    {
+        int k = (int)((modeling->geometry->yrec[recId] + 0.5f*modeling->dy) / modeling->dy) + modeling->nb;
+        int j = (int)((modeling->geometry->xrec[recId] + 0.5f*modeling->dx) / modeling->dx) + modeling->nb;
+        int i = (int)((modeling->geometry->zrec[recId] + 0.5f*modeling->dz) / modeling->dz) + modeling->nb;
+
+        h_rIdx[spread] = i + j*modeling->nzz + k*modeling->nxx*modeling->nzz;
+        h_rVal[spread] = dcal[spread + skipped] - dobs[spread + skipped];
+
+        ++spread;
+    }
+
+    cudaMemcpy(d_rIdx, h_rIdx, spread*sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_rVal, h_rVal, spread*sizeof(float), cudaMemcpyHostToDevice);
+
+    cudaMemset(d_L, 0, modeling->volsize*sizeof(float));
+    cudaMemset(d_R, 0, modeling->volsize*sizeof(float));
+
+    adjoint_sources<<<(spread + nThreads - 1) / nThreads, nThreads>>>(d_R, d_rIdx, d_rVal, spread);
+}
+
+void Tomography_ADJ::adjoint_solver()
+{
+    adjoint_initialization();
+
+    int nxx = modeling->nxx;
+    int nyy = modeling->nyy;
+    int nzz = modeling->nzz;
+
+    int total_levels = (nxx - 1) + (nyy - 1) + (nzz - 1);
+
+    for (int sweep = 0; sweep < NSWEEPS; sweep++)
+    {
+	    int start = (sweep == 3 || sweep == 5 || sweep == 6 || sweep == 7) ? total_levels : MESHDIM;
+	    int end = (start == MESHDIM) ? total_levels + 1 : MESHDIM - 1;
+	    int incr = (start == MESHDIM) ? true : false;
+
+	    int xSweepOff = (sweep == 3 || sweep == 4) ? nxx : 0;
+	    int ySweepOff = (sweep == 2 || sweep == 5) ? nyy : 0;
+	    int zSweepOff = (sweep == 1 || sweep == 6) ? nzz : 0;
+
+	    for (int level = start; level != end; level = (incr) ? level + 1 : level - 1)
+	    {
+            int xs = max(1, level - (nyy + nzz));
+            int ys = max(1, level - (nxx + nzz));
+
+            int xe = min(nxx, level - (MESHDIM - 1));
+            int ye = min(nyy, level - (MESHDIM - 1));
+
+            int xr = xe - xs + 1;
+            int yr = ye - ys + 1;
+
+            int nThrds = xr * yr;
+
+            dim3 bs(16, 16, 1);
+
+            if (nThrds < 32) { bs.x = xr; bs.y = yr; }
+
+            dim3 gs((xr + bs.x - 1) / bs.x, (yr + bs.y - 1) / bs.y, 1);
+
+            adjoint_sweep<<<gs, bs>>>(modeling->d_T, d_L, d_R, level, xs, ys, xSweepOff, ySweepOff, zSweepOff,
+                                      nxx, nyy, nzz, modeling->dx, modeling->dy, modeling->dz);
+	    }
+    }
+
+    adjoint_gradient<<<nBlocks, nThreads>>>(d_G, d_L, modeling->d_S, modeling->sIdx, modeling->sIdy, modeling->sIdz, nxx, nyy, nzz, modeling->nb);
+}
+
+void Tomography_ADJ::optimization()
+{
+    cudaMemcpy(h_G, d_G, modeling->volsize*sizeof(float), cudaMemcpyDeviceToHost);
+
+    modeling->reduce_boundary(h_G, gradient);
+
+    set_sensitivity_matrix();
+
+    get_parameter_variation();
+}
+
+void Tomography_ADJ::set_sensitivity_matrix()
+{
+    // The adjoint-state gradient is accumulated shot by shot, no sensitivity matrix is assembled.
+}
+
+void Tomography_ADJ::get_parameter_variation()
+{
+    float gTy = 0.0f;
+    float oTo = 0.0f;
+
+    # pragma omp parallel for reduction(+:gTy,oTo)
+    for (int index = 0; index < modeling->nPoints; index++)
+    {
+        gTy += gradient[index]*(gradient[index] - gradient_old[index]);
+        oTo += gradient_old[index]*gradient_old[index];
+    }
+
+    float beta = (iteration > 1) && (oTo > 0.0f) ? std::max(0.0f, gTy / oTo) : 0.0f;
+
+    float max_direction = 0.0f;
+    float max_slowness = 0.0f;
+
+    # pragma omp parallel for reduction(max:max_direction,max_slowness)
+    for (int index = 0; index < modeling->nPoints; index++)
+    {
+        direction[index] = beta*direction[index] - gradient[index];
+
+        gradient_old[index] = gradient[index];
+
+        int k = (int) (index / (modeling->nx*modeling->nz));
+        int j = (int) (index - k*modeling->nx*modeling->nz) / modeling->nz;
+        int i = (int) (index - j*modeling->nz - k*modeling->nx*modeling->nz);
+
+        int indb = (i + modeling->nb) + (j + modeling->nb)*modeling->nzz + (k + modeling->nb)*modeling->nxx*modeling->nzz;
+
+        max_direction = std::max(max_direction, fabsf(direction[index]));
+        max_slowness = std::max(max_slowness, modeling->S[indb]);
+    }
+
+    float alpha = (max_direction > 0.0f) ? max_variation*max_slowness / max_direction : 0.0f;
+
+    # pragma omp parallel for
+    for (int index = 0; index < modeling->nPoints; index++)
+        dS[index] = alpha*direction[index];
+}
+
+void Tomography_ADJ::model_update()
+{
+    model_smoothing(dS);
+
+    float * S0 = workspace.get<float>("adjoint_model", modeling->volsize, false);
+
+    std::copy(modeling->S, modeling->S + modeling->volsize, S0);
+
+    // Armijo backtracking on the batch residual, the first trial is the max_slowness_variation step.
+    // Smoothing may bend dS away from descent, then any decrease of the misfit is accepted.
+    // The misfit is the mean over the batch picks, so the slope of the summed misfit is scaled alike.
+
+    float slope = 0.0f;
+
+    # pragma omp parallel for reduction(+:slope)
+    for (int index = 0; index < modeling->nPoints; index++)
+        slope += gradient[index]*dS[index];
+
+    slope /= batch_picks();
+
+    float misfit = 0.5f*residuo.back()*residuo.back();
+
+    float step = 1.0f;
+
+    for (int trial = 0; trial <= max_backtracks; trial++, step *= 0.5f)
+    {
+        set_slowness_step(S0, step);
+
+        float trial_misfit = 0.5f*powf(batch_residual(), 2.0f);
+
+        bool decrease = (slope < 0.0f) ? (trial_misfit <= misfit + 1e-4f*step*slope) : (trial_misfit < misfit);
+
+        if (decrease) return;
+    }
+
+    // no trial step reduced the misfit, the model is kept and the conjugate directions restart
+
+    std::cout << "Adjoint-state step rejected after " << max_backtracks << " backtracks" << std::endl;
+
+    set_slowness_step(S0, 0.0f);
+
+    std::fill(direction, direction + modeling->nPoints, 0.0f);
+}
+
+void Tomography_ADJ::set_slowness_step(float * S0, float step)
+{
+    std::copy(S0, S0 + modeling->volsize, modeling->S);
+
+    # pragma omp parallel for
+    for (int index = 0; index < modeling->nPoints; index++)
+    {
+        int k = (int) (index / (modeling->nx*modeling->nz));
+        int j = (int) (index - k*modeling->nx*modeling->nz) / modeling->nz;
+        int i = (int) (index - j*modeling->nz - k*modeling->nx*modeling->nz);
+
+        int indb = (i + modeling->nb) + (j + modeling->nb)*modeling->nzz + (k + modeling->nb)*modeling->nxx*modeling->nzz;
+
+        modeling->S[indb] += step*dS[index];
+    }
+
+    modeling->copy_slowness_to_device();
+}
+
+float Tomography_ADJ::batch_residual()
+{
+    for (int shot = 0; shot < batch.size(); shot++)
+    {
+        modeling->srcId = batch[shot];
+
+        modeling->set_shot_point();
+        modeling->time_propagation();
+
+        concatenate_data(modeling);
+    }
+
+    return batch_rms();
+}
+
+void Tomography_ADJ::export_estimated_models()
+{
+    float * Vp = new float[modeling->nPoints]();
+    modeling->reduce_boundary(modeling->S, Vp);
+
+    # pragma omp parallel for
+    for (int index = 0; index < modeling->nPoints; index++)
+        Vp[index] = 1.0f / Vp[index];
+
+    std::string estimated_vp_path = estimated_model_folder + inversion_name + "_final_model_vp_" + std::to_string(modeling->nz) + "x" + std::to_string(modeling->nx) + "x" + std::to_string(modeling->ny) + ".bin";
+    export_binary_float(estimated_vp_path, Vp, modeling->nPoints);
+
+    delete[] Vp;
+}
+
+__global__ void adjoint_sources(float * R, int * rIdx, float * rVal, int spread)
+{
+    int index = blockIdx.x * blockDim.x + threadIdx.x;
+
+    if (index < spread) atomicAdd(&R[rIdx[index]], rVal[index]);
+}
+
+__global__ void adjoint_sweep(float * T, float * L, float * R, int level, int xOffset, int yOffset, int xSweepOffset, int ySweepOffset,
+                              int zSweepOffset, int nxx, int nyy, int nzz, float dx, float dy, float dz)
+{
+    int x = (blockIdx.x * blockDim.x + threadIdx.x) + xOffset;
+    int y = (blockIdx.y * blockDim.y + threadIdx.y) + yOffset;
+
+    if ((x < nxx) && (y < nyy))
+    {
+	    int z = level - (x + y);
+
+        if ((z >= 0) && (z < nzz))
+        {
+            int i = abs(z - zSweepOffset);
+            int j = abs(x - xSweepOffset);
+            int k = abs(y - ySweepOffset);
+
+            if ((i > 0) && (i < nzz-1) && (j > 0) && (j < nxx-1) && (k > 0) && (k < nyy-1))
+            {
+                int ijk = i + j*nzz + k*nxx*nzz;
+
+                // Upwind fluxes of a = -grad(T) on each cell face (Leung & Qian, 2006)
+
+                float azm = -(T[ijk] - T[(i-1) + j*nzz + k*nxx*nzz]) / dz;
+                float azp = -(T[(i+1) + j*nzz + k*nxx*nzz] - T[ijk]) / dz;
+
+                float axm = -(T[ijk] - T[i + (j-1)*nzz + k*nxx*nzz]) / dx;
+                float axp = -(T[i + (j+1)*nzz + k*nxx*nzz] - T[ijk]) / dx;
+
+                float aym = -(T[ijk] - T[i + j*nzz + (k-1)*nxx*nzz]) / dy;
+                float ayp = -(T[i + j*nzz + (k+1)*nxx*nzz] - T[ijk]) / dy;
+
+                float azm_p = 0.5f*(azm + fabsf(azm)); float azm_m = 0.5f*(azm - fabsf(azm));
+                float azp_p = 0.5f*(azp + fabsf(azp)); float azp_m = 0.5f*(azp - fabsf(azp));
+
+                float axm_p = 0.5f*(axm + fabsf(axm)); float axm_m = 0.5f*(axm - fabsf(axm));
+                float axp_p = 0.5f*(axp + fabsf(axp)); float axp_m = 0.5f*(axp - fabsf(axp));
+
+                float aym_p = 0.5f*(aym + fabsf(aym)); float aym_m = 0.5f*(aym - fabsf(aym));
+                float ayp_p = 0.5f*(ayp + fabsf(ayp)); float ayp_m = 0.5f*(ayp - fabsf(ayp));
+
+                float Lden = (azp_p - azm_m) / dz + (axp_p - axm_m) / dx + (ayp_p - aym_m) / dy;
+
+                float Lnum = (azm_p*L[(i-1) + j*nzz + k*nxx*nzz] - azp_m*L[(i+1) + j*nzz + k*nxx*nzz]) / dz +
+                             (axm_p*L[i + (j-1)*nzz + k*nxx*nzz] - axp_m*L[i + (j+1)*nzz + k*nxx*nzz]) / dx +
+                             (aym_p*L[i + j*nzz + (k-1)*nxx*nzz] - ayp_m*L[i + j*nzz + (k+1)*nxx*nzz]) / dy + R[ijk];
+
+                L[ijk] = (Lden > 1e-6f) ? Lnum / Lden : 0.0f;
+            }
+        }
+    }
+}
+
+__global__ void adjoint_gradient(float * G, float * L, float * S, int sIdx, int sIdy, int sIdz, int nxx, int nyy, int nzz, int nb)
+{
+    int index = blockIdx.x * blockDim.x + threadIdx.x;
+
+    int k = (int) (index / (nxx*nzz));
+    int j = (int) (index - k*nxx*nzz) / nzz;
+    int i = (int) (index - j*nzz - k*nxx*nzz);
+
+    if ((i >= nb) && (i < nzz-nb) && (j >= nb) && (j < nxx-nb) && (k >= nb) && (k < nyy-nb))
+    {
+        if ((abs(i - sIdz) > 1) || (abs(j - sIdx) > 1) || (abs(k - sIdy) > 1))
+            G[index] += L[index]*S[index];
+    }
+}
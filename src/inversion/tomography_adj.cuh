@@ -0,0 +1,60 @@
+# ifndef TOMOGRAPHY_ADJ_CUH
+# define TOMOGRAPHY_ADJ_CUH
+
+# include "inversion.hpp"
+
+class Tomography_ADJ : public Inversion
+{
+private:
+
+    int nBlocks;
+    int nThreads;
+
+    float max_variation;
+
+    int max_backtracks;
+
+    int * d_rIdx = nullptr;
+    float * d_rVal = nullptr;
+
+    int * h_rIdx = nullptr;
+    float * h_rVal = nullptr;
+
+    float * d_L = nullptr;
+    float * d_R = nullptr;
+    float * d_G = nullptr;
+
+    float * h_G = nullptr;
+
+    float * gradient = nullptr;
+    float * gradient_old = nullptr;
+    float * direction = nullptr;
+
+    void set_modeling_type();
+    void set_sensitivity_matrix();
+    void get_parameter_variation();
+    void export_estimated_models();
+
+    void adjoint_solver();
+    void adjoint_initialization();
+
+    float batch_residual();
+    void set_slowness_step(float * S0, float step);
+
+public:
+
+    ~Tomography_ADJ();
+
+    void forward_modeling();
+    void optimization();
+    void model_update();
+};
+
+__global__ void adjoint_sources(float * R, int * rIdx, float * rVal, int spread);
+
+__global__ void adjoint_sweep(float * T, float * L, float * R, int level, int xOffset, int yOffset, int xSweepOffset, int ySweepOffset,
+                              int zSweepOffset, int nxx, int nyy, int nzz, float dx, float dy, float dz);
+
+__global__ void adjoint_gradient(float * G, float * L, float * S, int sIdx, int sIdy, int sIdz, int nxx, int nyy, int nzz, int nb);
+
+# endif
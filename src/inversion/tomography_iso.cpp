@@ -22,12 +22,12 @@ void Tomography_ISO::set_sensitivity_matrix()
     N = n_data + (n_model - tk_order);                    
     NNZ = gsize + nnz;
 
-    iA = new int[NNZ]();
-    jA = new int[NNZ]();
-    vA = new float[NNZ]();
+    iA = workspace.get<int>("iA", NNZ);
+    jA = workspace.get<int>("jA", NNZ);
+    vA = workspace.get<float>("vA", NNZ);
 
-    B = new float[N]();
-    x = new float[M]();
+    B = workspace.get<float>("B", N);
+    x = workspace.get<float>("x", M);
     
     for (int index = 0; index < n_data; index++)
         W[index] = 0.0f;    
@@ -41,8 +41,9 @@ void Tomography_ISO::set_sensitivity_matrix()
         R[jG[index]] += vG[index];
     }   
 
+    # pragma omp parallel for
     for (int index = 0; index < n_data; index++) 
-        B[index] = (dobs[index] - dcal[index]) * powf(1.0f/W[index], 2.0f);
+        B[index] = (W[index] > 0.0f) ? (dobs[index] - dcal[index]) * powf(1.0f/W[index], 2.0f) : 0.0f;
 
     for (int index = 0; index < gsize; index++)
     {
@@ -61,10 +62,6 @@ void Tomography_ISO::set_sensitivity_matrix()
     std::vector< int >().swap(iG);
     std::vector< int >().swap(jG);
     std::vector<float>().swap(vG);        
-
-    delete[] iR;
-    delete[] jR;
-    delete[] vR;
 }
 
 void Tomography_ISO::get_parameter_variation()
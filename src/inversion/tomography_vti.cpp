@@ -19,6 +19,17 @@ void Tomography_VTI::set_modeling_type()
     dD = new float[modeling->nPoints]();    
 
     eikonal->get_stiffness_VTI(E,D);    
+
+    checkpoint_models = {E, D};
+}
+
+Tomography_VTI::~Tomography_VTI()
+{
+    delete[] E;
+    delete[] D;
+
+    delete[] dE;
+    delete[] dD;
 }
 
 void Tomography_VTI::set_sensitivity_matrix()
@@ -33,12 +44,12 @@ void Tomography_VTI::set_sensitivity_matrix()
     N = n_data + np*n;
     NNZ = np*(gsize + nnz);    
 
-    iA = new int[NNZ]();
-    jA = new int[NNZ]();
-    vA = new float[NNZ]();
+    iA = workspace.get<int>("iA", NNZ);
+    jA = workspace.get<int>("jA", NNZ);
+    vA = workspace.get<float>("vA", NNZ);
 
-    B = new float[N]();
-    x = new float[M]();    
+    B = workspace.get<float>("B", N);
+    x = workspace.get<float>("x", M);    
 
     # pragma omp parallel for
     for (int index = 0; index < n_data; index++)
@@ -60,7 +71,7 @@ void Tomography_VTI::set_sensitivity_matrix()
 
     # pragma omp parallel for
     for (int index = 0; index < n_data; index++) 
-        B[index] = (dobs[index] - dcal[index]) * powf(1.0f/W[index], 2.0f);
+        B[index] = (W[index] > 0.0f) ? (dobs[index] - dcal[index]) * powf(1.0f/W[index], 2.0f) : 0.0f;
 
     # pragma omp parallel for
     for (int index = 0; index < gsize; index++)
@@ -127,10 +138,6 @@ void Tomography_VTI::set_sensitivity_matrix()
     std::vector< int >().swap(iG);
     std::vector< int >().swap(jG);
     std::vector<float>().swap(vG);        
-
-    delete[] iR;
-    delete[] jR;
-    delete[] vR;
 }
 
 void Tomography_VTI::get_parameter_variation()
@@ -184,4 +191,11 @@ void Tomography_VTI::export_estimated_models()
     export_binary_float(estimated_v_path, V, modeling->nPoints);
     export_binary_float(estimated_e_path, E, modeling->nPoints);
     export_binary_float(estimated_d_path, D, modeling->nPoints);
+}
+
+void Tomography_VTI::refresh_device_models()
+{
+    modeling->copy_slowness_to_device();
+
+    eikonal->set_stiffness_VTI(E,D);
 }
\ No newline at end of file
@@ -19,9 +19,12 @@ private:
     void set_sensitivity_matrix();
     void get_parameter_variation();
     void export_estimated_models();    
+    void refresh_device_models();
 
 public:
 
+    ~Tomography_VTI();
+
     void model_update();
 };
 
@@ -1,12 +1,14 @@
-# include "../src/inversion/tomography_iso.hpp"
-# include "../src/inversion/tomography_ani.hpp"
+# include "inversion/tomography_iso.hpp"
+# include "inversion/tomography_vti.hpp"
+# include "inversion/tomography_adj.cuh"
 
 int main(int argc, char **argv)
 {
     std::vector<Inversion *> inversion = 
     {
         new Tomography_ISO(), 
-        new Tomography_ANI() 
+        new Tomography_VTI(), 
+        new Tomography_ADJ() 
     }; 
     
     auto file = std::string(argv[1]);
@@ -16,6 +18,9 @@ int main(int argc, char **argv)
 
     inversion[type]->set_parameters();
     inversion[type]->import_obsData();
+    inversion[type]->import_checkpoint();
+
+    show_peak_memory("data import");
 
     auto ti = std::chrono::system_clock::now();
 
@@ -28,12 +33,17 @@ int main(int argc, char **argv)
 
         inversion[type]->optimization();
         inversion[type]->model_update();
+        inversion[type]->export_checkpoint();
     }
 
     auto tf = std::chrono::system_clock::now();
 
     inversion[type]->export_results();
 
+    show_peak_memory("inversion");
+
+    export_configuration("inversion", file);
+
     std::chrono::duration<double> elapsed_seconds = tf - ti;
     std::cout << "\nRun time: " << elapsed_seconds.count() << " s." << std::endl;
 
@@ -0,0 +1,349 @@
+# include "seisfat3d.h"
+
+# include "../modeling/eikonal_iso.cuh"
+# include "../modeling/eikonal_ani.cuh"
+
+# include "../migration/kirchhoff_iso.cuh"
+# include "../migration/kirchhoff_ani.cuh"
+
+# include "../inversion/tomography_iso.hpp"
+# include "../inversion/tomography_vti.hpp"
+# include "../inversion/tomography_adj.cuh"
+
+// each calling thread reads the message of its own last failure
+
+static thread_local std::string last_error;
+
+// exceptions must not cross the C boundary, they are turned into error codes
+
+template <typename result, typename call>
+static result guarded(result failure, call body)
+{
+    try 
+    { 
+        return body(); 
+    }
+    catch (const std::exception &error)
+    {
+        last_error = error.what();
+        return failure;
+    }
+    catch (...)
+    {
+        last_error = "Error: \033[31munknown exception\033[0;0m inside the solver!";
+        return failure;
+    }
+}
+
+// handles created and not yet destroyed, with the handle of the solver owning them
+// when they were borrowed from a migration or inversion
+
+struct Handle
+{
+    std::string kind;
+    void * owner;
+};
+
+static std::map<void *, Handle> live_handles;
+
+template <typename solver> static std::string handle_kind();
+
+template <> std::string handle_kind<Modeling>() { return "modeling"; }
+template <> std::string handle_kind<Migration>() { return "migration"; }
+template <> std::string handle_kind<Inversion>() { return "inversion"; }
+
+static void add_handle(void * handle, std::string kind, void * owner = nullptr)
+{
+    # pragma omp critical(handles)
+    live_handles[handle] = {kind, owner};
+}
+
+// every handle call starts from a live solver, a released, foreign or missing one is reported
+
+template <typename solver>
+static solver * get_solver(void * handle, void ** owner = nullptr)
+{
+    bool live = false;
+
+    # pragma omp critical(handles)
+    {
+        auto entry = live_handles.find(handle);
+
+        if ((entry != live_handles.end()) && (entry->second.kind == handle_kind<solver>()))
+        {
+            live = true;
+            if (owner != nullptr) *owner = entry->second.owner;
+        }
+    }
+
+    if (!live)
+        throw std::invalid_argument("Error: \033[31mhandle\033[0;0m is not a live " + handle_kind<solver>() + " handle!");
+
+    return static_cast<solver *>(handle);
+}
+
+template <typename solver>
+static int destroy_solver(void * handle)
+{
+    void * owner = nullptr;
+
+    solver * released = get_solver<solver>(handle, &owner);
+
+    if (owner != nullptr)
+        throw std::invalid_argument("Error: \033[31mhandle\033[0;0m belongs to a migration or inversion and is destroyed with it!");
+
+    # pragma omp critical(handles)
+    {
+        live_handles.erase(handle);
+
+        for (auto entry = live_handles.begin(); entry != live_handles.end(); )
+            entry = (entry->second.owner == handle) ? live_handles.erase(entry) : std::next(entry);
+    }
+
+    delete released;
+
+    return 0;
+}
+
+const char * sf_last_error()
+{
+    return last_error.c_str();
+}
+
+int sf_catch_parameter(const char * parameters, const char * target, char * value, int length)
+{
+    return guarded(-1, [&]() 
+    {
+        std::string parameter = catch_parameter(target, parameters);
+
+        if ((int)parameter.size() >= length) 
+            throw std::invalid_argument("Error: \033[31m" + std::string(target) + "\033[0;0m does not fit the value buffer!");
+
+        std::copy(parameter.begin(), parameter.end(), value);
+        value[parameter.size()] = '\0';
+
+        return (int)parameter.size();
+    });
+}
+
+void * sf_modeling_create(const char * parameters, int type)
+{
+    return guarded<void *>(nullptr, [&]() 
+    {
+        Modeling * solver = nullptr;
+
+        if (type == 0) solver = new Eikonal_ISO();
+        if (type == 1) solver = new Eikonal_ANI();
+
+        if (solver == nullptr) 
+            throw std::invalid_argument("Error: \033[31mmodeling_type " + std::to_string(type) + "\033[0;0m does not exist!");
+
+        solver->parameters = parameters;
+        solver->set_parameters();
+
+        add_handle(solver, "modeling");
+
+        return (void *) solver;
+    });
+}
+
+int sf_modeling_destroy(void * handle)
+{
+    return guarded(-1, [&]() { return destroy_solver<Modeling>(handle); });
+}
+
+int sf_modeling_shape(void * handle, int * shape)
+{
+    return guarded(-1, [&]()
+    {
+        Modeling * modeling = get_solver<Modeling>(handle);
+
+        shape[0] = modeling->nzz;
+        shape[1] = modeling->nxx;
+        shape[2] = modeling->nyy;
+        shape[3] = modeling->nb;
+        shape[4] = modeling->geometry->nrel;
+
+        return 0;
+    });
+}
+
+int sf_modeling_spread(void * handle, int shot)
+{
+    return guarded(-1, [&]()
+    {
+        Modeling * modeling = get_solver<Modeling>(handle);
+
+        if ((shot < 0) || (shot >= modeling->geometry->nrel))
+            throw std::invalid_argument("Error: \033[31mshot " + std::to_string(shot) + "\033[0;0m is out of the geometry!");
+
+        return modeling->geometry->spread[shot];
+    });
+}
+
+int sf_modeling_solve(void * handle, int shot)
+{
+    return guarded(-1, [&]()
+    {
+        Modeling * modeling = get_solver<Modeling>(handle);
+
+        if ((shot < 0) || (shot >= modeling->geometry->nrel))
+            throw std::invalid_argument("Error: \033[31mshot " + std::to_string(shot) + "\033[0;0m is out of the geometry!");
+
+        modeling->srcId = shot;
+
+        modeling->set_shot_point();
+        modeling->time_propagation();
+        modeling->compute_seismogram();
+
+        return 0;
+    });
+}
+
+int sf_modeling_update_slowness(void * handle)
+{
+    return guarded(-1, [&]()
+    {
+        get_solver<Modeling>(handle)->copy_slowness_to_device();
+
+        return 0;
+    });
+}
+
+float * sf_modeling_slowness(void * handle)
+{
+    return guarded<float *>(nullptr, [&]() { return get_solver<Modeling>(handle)->S; });
+}
+
+float * sf_modeling_times(void * handle)
+{
+    return guarded<float *>(nullptr, [&]() { return get_solver<Modeling>(handle)->T; });
+}
+
+float * sf_modeling_seismogram(void * handle)
+{
+    return guarded<float *>(nullptr, [&]() { return get_solver<Modeling>(handle)->seismogram; });
+}
+
+void * sf_migration_create(const char * parameters, int type)
+{
+    return guarded<void *>(nullptr, [&]() 
+    {
+        Migration * solver = nullptr;
+
+        if (type == 0) solver = new Kirchhoff_ISO();
+        if (type == 1) solver = new Kirchhoff_ANI();
+
+        if (solver == nullptr) 
+            throw std::invalid_argument("Error: \033[31mmigration_type " + std::to_string(type) + "\033[0;0m does not exist!");
+
+        solver->parameters = parameters;
+        solver->set_parameters();
+
+        add_handle(solver, "migration");
+        add_handle(solver->get_modeling(), "modeling", solver);
+
+        return (void *) solver;
+    });
+}
+
+int sf_migration_destroy(void * handle)
+{
+    return guarded(-1, [&]() { return destroy_solver<Migration>(handle); });
+}
+
+int sf_migration_run(void * handle)
+{
+    return guarded(-1, [&]()
+    {
+        get_solver<Migration>(handle)->image_building();
+
+        return 0;
+    });
+}
+
+float * sf_migration_image(void * handle, int * shape)
+{
+    return guarded<float *>(nullptr, [&]() { return get_solver<Migration>(handle)->get_image(shape); });
+}
+
+void * sf_migration_modeling(void * handle)
+{
+    return guarded<void *>(nullptr, [&]() { return (void *) get_solver<Migration>(handle)->get_modeling(); });
+}
+
+void * sf_inversion_create(const char * parameters, int type, int import_data)
+{
+    return guarded<void *>(nullptr, [&]() 
+    {
+        Inversion * solver = nullptr;
+
+        if (type == 0) solver = new Tomography_ISO();
+        if (type == 1) solver = new Tomography_VTI();
+        if (type == 2) solver = new Tomography_ADJ();
+
+        if (solver == nullptr) 
+            throw std::invalid_argument("Error: \033[31minversion_type " + std::to_string(type) + "\033[0;0m does not exist!");
+
+        solver->parameters = parameters;
+        solver->set_parameters();
+
+        // without files the observed picks are written through sf_inversion_observed
+
+        if (import_data) 
+            solver->import_obsData();
+        else
+            solver->set_obsData();
+
+        solver->import_checkpoint();
+
+        add_handle(solver, "inversion");
+        add_handle(solver->get_modeling(), "modeling", solver);
+
+        return (void *) solver;
+    });
+}
+
+int sf_inversion_destroy(void * handle)
+{
+    return guarded(-1, [&]() { return destroy_solver<Inversion>(handle); });
+}
+
+int sf_inversion_iterate(void * handle)
+{
+    return guarded(-1, [&]()
+    {
+        Inversion * inversion = get_solver<Inversion>(handle);
+
+        inversion->forward_modeling();
+        inversion->check_convergence();
+
+        if (inversion->converged) return 1; 
+
+        inversion->optimization();
+        inversion->model_update();
+        inversion->export_checkpoint();
+
+        return 0;
+    });
+}
+
+int sf_inversion_finish(void * handle)
+{
+    return guarded(-1, [&]()
+    {
+        get_solver<Inversion>(handle)->export_results();
+
+        return 0;
+    });
+}
+
+float * sf_inversion_observed(void * handle, int * size)
+{
+    return guarded<float *>(nullptr, [&]() { return get_solver<Inversion>(handle)->get_obsData(*size); });
+}
+
+void * sf_inversion_modeling(void * handle)
+{
+    return guarded<void *>(nullptr, [&]() { return (void *) get_solver<Inversion>(handle)->get_modeling(); });
+}
@@ -0,0 +1,48 @@
+# ifndef SEISFAT3D_H
+# define SEISFAT3D_H
+
+// C interface of the solvers for in-process use. Handles are opaque, volumes and
+// gathers are returned as pointers into the solver buffers and stay valid while 
+// the handle lives. Integer calls return -1 and pointer calls nullptr on failure,
+// with the message kept in sf_last_error. Handles from the sf_*_create calls are
+// released with the matching sf_*_destroy, the modeling handles of a migration or
+// inversion belong to it and are released along with it. Calls on a destroyed or
+// unknown handle fail like any other call, sf_last_error is kept per thread.
+
+extern "C"
+{
+    const char * sf_last_error();
+
+    int sf_catch_parameter(const char * parameters, const char * target, char * value, int length);
+
+    void * sf_modeling_create(const char * parameters, int type);
+    int sf_modeling_destroy(void * handle);
+
+    int sf_modeling_shape(void * handle, int * shape);
+    int sf_modeling_spread(void * handle, int shot);
+    int sf_modeling_solve(void * handle, int shot);
+    int sf_modeling_update_slowness(void * handle);
+
+    float * sf_modeling_slowness(void * handle);
+    float * sf_modeling_times(void * handle);
+    float * sf_modeling_seismogram(void * handle);
+
+    void * sf_migration_create(const char * parameters, int type);
+    int sf_migration_destroy(void * handle);
+
+    int sf_migration_run(void * handle);
+
+    float * sf_migration_image(void * handle, int * shape);
+    void * sf_migration_modeling(void * handle);
+
+    void * sf_inversion_create(const char * parameters, int type, int import_data);
+    int sf_inversion_destroy(void * handle);
+
+    int sf_inversion_iterate(void * handle);
+    int sf_inversion_finish(void * handle);
+
+    float * sf_inversion_observed(void * handle, int * size);
+    void * sf_inversion_modeling(void * handle);
+}
+
+# endif
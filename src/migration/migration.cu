@@ -7,44 +7,290 @@ void Migration::set_parameters()
 
     max_offset = std::stof(catch_parameter("max_offset", parameters));    
 
+    offset_classes = std::stoi(catch_parameter("offset_classes", parameters));
+
     aperture_x = std::stof(catch_parameter("mig_aperture_x", parameters));
     aperture_y = std::stof(catch_parameter("mig_aperture_y", parameters));
 
+    aperture_cutoff = std::stof(catch_parameter("aperture_cutoff", parameters));
+
+    if ((aperture_cutoff <= 0.0f) || (aperture_cutoff >= 1.0f))
+        throw std::invalid_argument("Error: \033[31maperture_cutoff\033[0;0m must lie between 0 and 1!");
+
+    tan_x = tanf(aperture_x * M_PI / 180.0f);
+    tan_y = tanf(aperture_y * M_PI / 180.0f);
+
+    taper_radius = sqrtf(-2.0f*logf(aperture_cutoff));
+
+    depth_bands = std::stoi(catch_parameter("depth_bands", parameters));
+
+    if (depth_bands < 1)
+        throw std::invalid_argument("Error: \033[31mdepth_bands\033[0;0m must be a positive integer!");
+
     input_data_folder = catch_parameter("input_data_folder", parameters);
     input_data_prefix = catch_parameter("input_data_prefix", parameters);
 
     output_image_folder = catch_parameter("output_image_folder", parameters);
     output_table_folder = catch_parameter("output_table_folder", parameters);
 
+    cpu_imaging = str2bool(catch_parameter("cpu_imaging", parameters));
+    trace_block = std::stoi(catch_parameter("trace_block", parameters));
+    table_bits = std::stoi(catch_parameter("table_bits", parameters));
+
+    if ((table_bits != 8) && (table_bits != 16) && (table_bits != 32))
+        throw std::invalid_argument("Error: \033[31mtable_bits\033[0;0m must be 8, 16 or 32!");
+
+    image_scale = std::stoi(catch_parameter("image_scale", parameters));
+
+    table_memory_budget = std::stof(catch_parameter("table_memory_budget", parameters));
+
+    receiver_major = str2bool(catch_parameter("receiver_major", parameters));
+
+    image_window = str2bool(catch_parameter("image_window", parameters));
+
+    streaming_mode = str2bool(catch_parameter("streaming_mode", parameters));
+    snapshot_frequency = std::stoi(catch_parameter("snapshot_frequency", parameters));
+
+    if (snapshot_frequency < 1)
+        throw std::invalid_argument("Error: \033[31msnapshot_frequency\033[0;0m must be at least one shot!");
+
+    polling_interval = std::stof(catch_parameter("polling_interval", parameters));
+    streaming_timeout = std::stof(catch_parameter("streaming_timeout", parameters));
+
+    if (streaming_mode && ((polling_interval <= 0.0f) || (streaming_timeout <= 0.0f)))
+        throw std::invalid_argument("Error: \033[31mpolling_interval\033[0;0m and \033[31mstreaming_timeout\033[0;0m must be positive!");
+
+    imaged_shots = 0;
+
     set_modeling_type();
     
     modeling->parameters = parameters;
     modeling->set_parameters();
 
-    f_image = new float[modeling->nPoints]();
-    h_image = new float[modeling->volsize]();
-    h_seismic = new float[nt*modeling->max_spread]();
+    idx = modeling->dx;
+    idy = modeling->dy;
+    idz = modeling->dz;
+
+    set_image_window();
+
+    // receiver tables written by earlier runs are only picked up for the same model, geometry and window
+
+    table_key = hash_parameters({"x_samples", "y_samples", "z_samples", "x_spacing", "y_spacing", "z_spacing", "vp_model_file", 
+                                 "Cijkl_folder", "anisotropy_symmetry", "RPS", "migration_type", "image_scale", "image_window", 
+                                 "window_zmin", "window_zmax", "window_xmin", "window_xmax", "window_ymin", "window_ymax"}, parameters);
+
+    image_size = inx*iny*inz;
 
-    cudaMalloc((void**)&(d_Tr), modeling->volsize*sizeof(float));
-    cudaMalloc((void**)&(d_image), modeling->volsize*sizeof(float));
-    cudaMalloc((void**)&(d_seismic), nt*modeling->max_spread*sizeof(float));
+    float table_bytes = cpu_imaging ? table_size*table_bits/8 : table_size*sizeof(float);
+
+    float shot_bytes = table_bytes + nt*modeling->max_spread*sizeof(float);
+
+    resident_shots = std::max(1, std::min(modeling->geometry->nrel, (int)(table_memory_budget*1e6f / shot_bytes)));
+
+    plan_memory();
+
+    h_image = new float[offset_classes*image_size]();
+    h_table = new float[table_size]();
+    h_seismic = new float[resident_shots*nt*modeling->max_spread]();
+
+    cudaMalloc((void**)&(d_Tr), table_size*sizeof(float));
+    cudaMalloc((void**)&(d_image), offset_classes*image_size*sizeof(float));
+    cudaMalloc((void**)&(d_seismic), resident_shots*nt*modeling->max_spread*sizeof(float));
+
+    if (!cpu_imaging) cudaMalloc((void**)&(d_Ts), resident_shots*table_size*sizeof(float));
 
     nThreads = 256;
-    nBlocks = (int)((modeling->volsize + nThreads - 1) / nThreads);
+    nBlocks = (int)((image_size + nThreads - 1) / nThreads);
+
+    // the aperture widens with depth, so each trace is launched over depth bands of growing footprint
+
+    depth_bands = std::min(depth_bands, inz);
+
+    if (cpu_imaging)
+    {
+        // quantized tables keep one offset and scale per depth column
+
+        if (table_bits == 32)
+        {
+            h_Ts = new float[resident_shots*table_size]();
+            h_Tr = new float[trace_block*table_size]();
+        }
+        else if (table_bits == 16)
+        {
+            q16_Ts.allocate(resident_shots*table_size, tnz);
+            q16_Tr.allocate(trace_block*table_size, tnz);
+        }
+        else
+        {
+            q8_Ts.allocate(resident_shots*table_size, tnz);
+            q8_Tr.allocate(trace_block*table_size, tnz);
+        }
+
+        sigma_x2 = new float[inz]();
+        sigma_y2 = new float[inz]();
+
+        table_z = new int[inz]();
+        table_wz = new float[inz]();
+
+        for (int i = 0; i < inz; i++)
+        {
+            int gi = i + wz0;
+
+            float sigma_x = tan_x*gi*idz;
+            float sigma_y = tan_y*gi*idz;
+
+            sigma_x2[i] = 1.0f / powf(sigma_x + 1e-6f, 2.0f);
+            sigma_y2[i] = 1.0f / powf(sigma_y + 1e-6f, 2.0f);
+
+            int iz;
+
+            table_wz[i] = table_weight(gi, image_scale, modeling->nz, iz);
+            table_z[i] = iz - tz0;
+        }
+    }
+}
+
+void Migration::plan_memory()
+{
+    double model_bytes = modeling->host_bytes;
+    double device_bytes = modeling->device_bytes;
+
+    auto estimate = [&]()
+    {
+        double image = offset_classes*image_size*sizeof(float);
+        double gathers = resident_shots*nt*modeling->max_spread*sizeof(float);
+
+        modeling->host_bytes = model_bytes + image + gathers + table_size*sizeof(float);
+        modeling->device_bytes = device_bytes + image + gathers + table_size*sizeof(float);
+
+        if (offset_classes > 1) modeling->host_bytes += image_size*sizeof(float);
+
+        if (cpu_imaging)
+            modeling->host_bytes += (resident_shots + trace_block)*table_size*table_bits/8.0 + 4.0*inz*sizeof(float);
+        else
+            modeling->device_bytes += resident_shots*table_size*sizeof(float);
+    };
+
+    estimate();
+
+    // fewer resident shots first, then host imaging, then coarser host tables
+
+    while (!modeling->fits_memory_budget() && (resident_shots > 1))
+    {
+        resident_shots /= 2;
+        estimate();
+    }
+
+    if (!modeling->fits_memory_budget() && !cpu_imaging)
+    {
+        cpu_imaging = true;
+        estimate();
+    }
+
+    while (!modeling->fits_memory_budget() && cpu_imaging && (table_bits > 8))
+    {
+        table_bits /= 2;
+        estimate();
+    }
+
+    while (!modeling->fits_memory_budget() && cpu_imaging && (trace_block > 1))
+    {
+        trace_block /= 2;
+        estimate();
+    }
+
+    std::cout << "Memory plan: " << resident_shots << " resident shots, " << (cpu_imaging ? "host" : "device") << " imaging, " << table_bits << " bit tables" << std::endl;
+
+    modeling->check_memory_budget("migration");
+}
+
+void Migration::set_image_window()
+{
+    // image indices of the target box on the model grid
+
+    wx0 = 0; wx1 = modeling->nx - 1;
+    wy0 = 0; wy1 = modeling->ny - 1;
+    wz0 = 0; wz1 = modeling->nz - 1;
+
+    if (image_window)
+    {
+        wz0 = std::max(wz0, (int)floorf(std::stof(catch_parameter("window_zmin", parameters)) / idz));
+        wx0 = std::max(wx0, (int)floorf(std::stof(catch_parameter("window_xmin", parameters)) / idx));
+        wy0 = std::max(wy0, (int)floorf(std::stof(catch_parameter("window_ymin", parameters)) / idy));
+
+        wz1 = std::min(wz1, (int)ceilf(std::stof(catch_parameter("window_zmax", parameters)) / idz));
+        wx1 = std::min(wx1, (int)ceilf(std::stof(catch_parameter("window_xmax", parameters)) / idx));
+        wy1 = std::min(wy1, (int)ceilf(std::stof(catch_parameter("window_ymax", parameters)) / idy));
+
+        if ((wz1 < wz0) || (wx1 < wx0) || (wy1 < wy0))
+            throw std::invalid_argument("Error: \033[31mimaging window\033[0;0m lies outside the model!");
+    }
+
+    inz = wz1 - wz0 + 1;
+    inx = wx1 - wx0 + 1;
+    iny = wy1 - wy0 + 1;
+
+    // table box in decimated node indices, including the upper node of the last interpolation cell
+
+    int tz1, tx1, ty1;
+
+    table_weight(wz0, image_scale, modeling->nz, tz0);
+    table_weight(wx0, image_scale, modeling->nx, tx0);
+    table_weight(wy0, image_scale, modeling->ny, ty0);
+
+    table_weight(wz1, image_scale, modeling->nz, tz1);
+    table_weight(wx1, image_scale, modeling->nx, tx1);
+    table_weight(wy1, image_scale, modeling->ny, ty1);
+
+    tnz = tz1 - tz0 + 2;
+    tnx = tx1 - tx0 + 2;
+    tny = ty1 - ty0 + 2;
+
+    table_size = tnz*tnx*tny;
+}
+
+void Migration::crop_table(float * T, float * table)
+{
+    int nb = modeling->nb;
+
+    // every image_scale-th model node, the last table node is clamped onto the model edge
+
+    # pragma omp parallel for collapse(2)
+    for (int k = 0; k < tny; k++)
+    {
+        for (int j = 0; j < tnx; j++)
+        {
+            int gj = std::min((j + tx0)*image_scale, modeling->nx - 1);
+            int gk = std::min((k + ty0)*image_scale, modeling->ny - 1);
+
+            for (int i = 0; i < tnz; i++)
+            {
+                int gi = std::min((i + tz0)*image_scale, modeling->nz - 1);
+
+                table[i + j*tnz + k*tnx*tnz] = T[(gi + nb) + (gj + nb)*modeling->nzz + (gk + nb)*modeling->nxx*modeling->nzz];
+            }
+        }
+    }
 }
 
-void Migration::read_seismic_data()
+void Migration::read_seismic_data(int slot)
 {
     std::string data_path = input_data_folder + input_data_prefix + std::to_string(modeling->geometry->sInd[modeling->srcId]+1) + ".bin";
 
-    import_binary_float(data_path, h_seismic, nt*modeling->geometry->spread[modeling->srcId]);
+    int skipped = slot*nt*modeling->max_spread;
 
-    cudaMemcpy(d_seismic, h_seismic, nt*modeling->geometry->spread[modeling->srcId]*sizeof(float), cudaMemcpyHostToDevice);
+    import_binary_float(data_path, h_seismic + skipped, nt*modeling->geometry->spread[modeling->srcId]);
+
+    cudaMemcpy(d_seismic + skipped, h_seismic + skipped, nt*modeling->geometry->spread[modeling->srcId]*sizeof(float), cudaMemcpyHostToDevice);
 }
 
 void Migration::image_building()
 {
-    get_receiver_eikonal();
+    // receiver tables were already written by the run that left the snapshot
+
+    if (!(streaming_mode && import_snapshot())) 
+        get_receiver_eikonal();
+    
     run_cross_correlation();
 }
 
@@ -92,83 +338,641 @@ void Migration::show_information()
 
 void Migration::export_receiver_eikonal()
 {
-    cudaMemcpy(modeling->T, modeling->d_T, modeling->volsize*sizeof(float), cudaMemcpyDeviceToHost);
+    modeling->copy_time_to_host();
 
-    export_binary_float(output_table_folder + "eikonal_receiver_" + std::to_string(modeling->recId+1) + ".bin", modeling->T, modeling->nPoints);    
+    crop_table(modeling->T, h_table);
+
+    export_binary_float(receiver_table_path(), h_table, table_size);    
+}
+
+std::string Migration::receiver_table_path()
+{
+    return output_table_folder + "eikonal_receiver_" + table_key + "_" + std::to_string(modeling->recId+1) + ".bin";
 }
 
 void Migration::run_cross_correlation()
 {
-    cudaMemset(d_image, 0.0f, modeling->volsize*sizeof(float));
+    if (imaged_shots == 0) cudaMemset(d_image, 0.0f, offset_classes*image_size*sizeof(float));
+
+    while (imaged_shots < modeling->geometry->nrel)
+    {
+        int shots = std::min(resident_shots, modeling->geometry->nrel - imaged_shots);
+
+        if (streaming_mode)
+        {
+            shots = std::min(shots, snapshot_frequency - imaged_shots % snapshot_frequency);
+
+            for (int shot = imaged_shots; shot < imaged_shots + shots; shot++) 
+                wait_for_shot_data(shot);
+        }
+
+        get_resident_shots(imaged_shots, shots);
+
+        image_resident_traces();
+
+        imaged_shots += shots;
+
+        if (streaming_mode && ((imaged_shots % snapshot_frequency == 0) || (imaged_shots == modeling->geometry->nrel)))
+            export_snapshot();
+    }
+}
+
+void Migration::image_resident_traces()
+{
+    std::cout << "\nKirchhoff depth migration: computing image matrix\n";
+
+    int tables = 0;
+    int block_first = 0;
+
+    for (int t = 0; t < trace_order.size(); t++)
+    {
+        int trace = trace_order[t];
+
+        modeling->recId = trace_receiver[trace];
+
+        bool new_receiver = (t == 0) || (modeling->recId != trace_receiver[trace_order[t-1]]);
+
+        std::string table_path = receiver_table_path();
+
+        if (cpu_imaging)
+        {
+            if (new_receiver && (tables == trace_block))
+            {
+                cpu_cross_correlation(block_first, t);
+
+                block_first = t;
+                tables = 0;
+            }
+
+            if (new_receiver) 
+            {
+                import_binary_float(table_path, h_table, table_size);
+
+                store_table(h_table, false, tables++);
+            }
+
+            trace_table[trace] = tables - 1;
+        }
+        else
+        {
+            if (new_receiver)
+            {
+                import_binary_float(table_path, modeling->T, table_size);
+        
+                cudaMemcpy(d_Tr, modeling->T, table_size*sizeof(float), cudaMemcpyHostToDevice);
+            }
+
+            float * Ts = d_Ts + trace_slot[trace]*table_size;
+            float * image = d_image + trace_class[trace]*image_size;
+            float * seismic = d_seismic + trace_slot[trace]*nt*modeling->max_spread;
+
+            for (int band = 0; band < depth_bands; band++)
+            {
+                int i0 = band*inz / depth_bands;
+                int i1 = (band + 1)*inz / depth_bands;
+
+                int j0, j1, k0, k1;
+
+                get_aperture_footprint(trace_cmp_x[trace], trace_cmp_y[trace], (wz0 + i1 - 1)*idz, j0, j1, k0, k1);
+
+                int box_nz = i1 - i0;
+                int box_nx = j1 - j0;
+                int box_ny = k1 - k0;
+
+                if ((box_nz > 0) && (box_nx > 0) && (box_ny > 0))
+                {
+                    int box_blocks = (int)((box_nz*box_nx*box_ny + nThreads - 1) / nThreads);
+
+                    cross_correlation<<<box_blocks, nThreads>>>(Ts, d_Tr, image, seismic, tan_x, tan_y, taper_radius, trace_cmp_x[trace], trace_cmp_y[trace], trace_spread[trace], 
+                                                                i0, j0, k0, box_nz, box_nx, box_ny, inx, iny, inz, wx0, wy0, wz0, idx, idy, idz, tx0, ty0, tz0, tnx, tnz, 
+                                                                modeling->nx, modeling->ny, modeling->nz, image_scale, nt, dt);
+                }
+            }
+        }
+    }
+
+    if (cpu_imaging && (block_first < trace_order.size())) 
+        cpu_cross_correlation(block_first, trace_order.size());
+}
+
+void Migration::wait_for_shot_data(int shot)
+{
+    std::string data_path = input_data_folder + input_data_prefix + std::to_string(modeling->geometry->sInd[shot]+1) + ".bin";
+
+    long expected_bytes = (long)(nt)*modeling->geometry->spread[shot]*sizeof(float);
+
+    // a gather still being copied in shows up with fewer bytes than expected
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (true)
+    {
+        std::ifstream file(data_path, std::ios::in | std::ios::binary | std::ios::ate);
+
+        if (file.is_open() && (long)(file.tellg()) >= expected_bytes) return;
+
+        std::chrono::duration<float> waited = std::chrono::steady_clock::now() - start;
+
+        if (waited.count() >= streaming_timeout)
+            throw std::invalid_argument("Error: \033[31m" + data_path + "\033[0;0m did not arrive within the streaming timeout!");
+
+        std::cout << "\rWaiting for \033[34m" << data_path << "\033[0;0m (" << (int)(waited.count()) << " s)" << std::flush;
+
+        std::this_thread::sleep_for(std::chrono::duration<float>(polling_interval));
+    }
+}
+
+std::string Migration::snapshot_path()
+{
+    return output_image_folder + "kirchhoff_snapshot.bin";
+}
+
+bool Migration::import_snapshot()
+{
+    std::ifstream file(snapshot_path(), std::ios::in | std::ios::binary);
 
-    for (modeling->srcId = 0; modeling->srcId < modeling->geometry->nrel; modeling->srcId++)
+    if (!file.is_open()) return false;
+
+    // imaged shots, total shots, image size and the length of the table key that follows
+
+    int header[4];
+
+    file.read((char *) header, 4*sizeof(int));
+
+    std::string key(std::max(0, std::min(header[3], 64)), ' ');
+
+    file.read(&key[0], key.size());
+
+    if (!file || (header[1] != modeling->geometry->nrel) || (header[2] != offset_classes*image_size) || (key != table_key))
+        throw std::invalid_argument("Error: \033[31m" + snapshot_path() + "\033[0;0m does not match the current migration setup!");
+
+    imaged_shots = header[0];
+
+    file.read((char *) h_image, offset_classes*image_size*sizeof(float));
+    file.close();
+
+    if (!cpu_imaging) cudaMemcpy(d_image, h_image, offset_classes*image_size*sizeof(float), cudaMemcpyHostToDevice);
+
+    std::cout << "Resuming Kirchhoff migration after " << imaged_shots << " imaged shots" << std::endl;
+
+    return true;
+}
+
+void Migration::export_snapshot()
+{
+    if (!cpu_imaging) cudaMemcpy(h_image, d_image, offset_classes*image_size*sizeof(float), cudaMemcpyDeviceToHost);
+
+    int header[4] = {imaged_shots, modeling->geometry->nrel, offset_classes*image_size, (int)(table_key.size())};
+
+    std::ofstream file(snapshot_path() + ".tmp", std::ios::out | std::ios::binary);
+
+    if (!file.is_open())
+    {
+        std::cerr << "Error: \033[31m" << snapshot_path() << "\033[0;0m could not be opened!" << std::endl;
+        return;
+    }
+
+    file.write((char *) header, 4*sizeof(int));
+    file.write(table_key.data(), table_key.size());
+    file.write((char *) h_image, offset_classes*image_size*sizeof(float));
+    file.close();
+
+    std::rename((snapshot_path() + ".tmp").c_str(), snapshot_path().c_str());
+}
+
+void Migration::get_resident_shots(int first_shot, int shots)
+{
+    trace_slot.clear();
+    trace_class.clear();
+    trace_table.clear();
+    trace_spread.clear();
+    trace_receiver.clear();
+    
+    trace_cmp_x.clear();
+    trace_cmp_y.clear();
+
+    for (int slot = 0; slot < shots; slot++)
     {
-        read_seismic_data();
+        modeling->srcId = first_shot + slot;
+
+        read_seismic_data(slot);
 
         modeling->set_shot_point();
         modeling->show_information();
         modeling->time_propagation();
 
-        std::cout << "\nKirchhoff depth migration: computing image matrix\n";
+        // device tables are cropped where the solver left them, the decomposed solver keeps its times on the host
+
+        if (!cpu_imaging && !modeling->domain_decomposition)
+        {
+            int crop_blocks = (int)((table_size + nThreads - 1) / nThreads);
+
+            device_crop_table<<<crop_blocks, nThreads>>>(modeling->d_T, d_Ts + slot*table_size, tx0, ty0, tz0, tnx, tny, tnz, image_scale, 
+                                                         modeling->nx, modeling->ny, modeling->nz, modeling->nxx, modeling->nzz, modeling->nb);
+        }
+        else
+        {
+            modeling->copy_time_to_host();
+
+            crop_table(modeling->T, h_table);
+
+            if (cpu_imaging) 
+                store_table(h_table, true, slot);
+            else
+                cudaMemcpy(d_Ts + slot*table_size, h_table, table_size*sizeof(float), cudaMemcpyHostToDevice);
+        }
 
         int spread = 0;
-        
-        for (modeling->recId = modeling->geometry->iRec[modeling->srcId]; modeling->recId < modeling->geometry->fRec[modeling->srcId]; modeling->recId++)
+
+        for (int recId = modeling->geometry->iRec[modeling->srcId]; recId < modeling->geometry->fRec[modeling->srcId]; recId++)
         {
-            float rx = modeling->geometry->xrec[modeling->recId];
-            float ry = modeling->geometry->yrec[modeling->recId];
+            float rx = modeling->geometry->xrec[recId];
+            float ry = modeling->geometry->yrec[recId];
 
             float offset = sqrtf(powf(modeling->sx - rx, 2.0f) + powf(modeling->sy - ry, 2.0f));
 
-            float cmp_x = modeling->sx + 0.5f*(rx - modeling->sx);
-            float cmp_y = modeling->sy + 0.5f*(ry - modeling->sy);
-
             if (offset < max_offset)
             {
-                import_binary_float(output_table_folder + "eikonal_receiver_" + std::to_string(modeling->recId+1) + ".bin", modeling->T, modeling->volsize);
-            
-                cudaMemcpy(d_Tr, modeling->T, modeling->volsize*sizeof(float), cudaMemcpyHostToDevice);
-
-                cross_correlation<<<nBlocks, nThreads>>>(modeling->d_T, d_Tr, d_image, d_seismic, aperture_x, aperture_y, cmp_x, cmp_y, spread, modeling->nxx, 
-                                                         modeling->nyy, modeling->nzz, modeling->nb, modeling->dx, modeling->dy, modeling->dz, nt, dt);
+                trace_slot.push_back(slot);
+                trace_table.push_back(0);
+                trace_class.push_back(std::min((int)(offset / max_offset * offset_classes), offset_classes - 1));
+                trace_spread.push_back(spread);
+                trace_receiver.push_back(recId);
+
+                trace_cmp_x.push_back(modeling->sx + 0.5f*(rx - modeling->sx));
+                trace_cmp_y.push_back(modeling->sy + 0.5f*(ry - modeling->sy));
             }
 
             ++spread;
         }
     }
+
+    trace_order.resize(trace_receiver.size());
+
+    for (int trace = 0; trace < trace_order.size(); trace++) 
+        trace_order[trace] = trace;
+
+    // grouping by receiver reorders the per-voxel sums across shots, so the image agrees with the 
+    // shot-major order only to float rounding, see tests/migration/compare_imaging_order.py
+
+    if (receiver_major) std::stable_sort(trace_order.begin(), trace_order.end(), [this](int a, int b) {return trace_receiver[a] < trace_receiver[b];});
+}
+
+void Migration::get_aperture_footprint(float cmp_x, float cmp_y, float max_depth, int &j0, int &j1, int &k0, int &k1)
+{
+    float half_x = std::min(tan_x*max_depth*taper_radius, 1e9f);
+    float half_y = std::min(tan_y*max_depth*taper_radius, 1e9f);
+
+    j0 = (int)std::max(1.0f, floorf((cmp_x - half_x) / idx));
+    k0 = (int)std::max(1.0f, floorf((cmp_y - half_y) / idy));
+
+    j1 = (int)std::min((float)(wx1 + 1), ceilf((cmp_x + half_x) / idx) + 1);
+    k1 = (int)std::min((float)(wy1 + 1), ceilf((cmp_y + half_y) / idy) + 1);
+
+    j0 = std::max(j0, wx0) - wx0; j1 -= wx0;
+    k0 = std::max(k0, wy0) - wy0; k1 -= wy0;
+}
+
+void Migration::cpu_cross_correlation(int first, int last)
+{
+    int j0 = inx, j1 = 0;
+    int k0 = iny, k1 = 0;
+
+    for (int t = first; t < last; t++)
+    {
+        int tj0, tj1, tk0, tk1;
+
+        get_aperture_footprint(trace_cmp_x[trace_order[t]], trace_cmp_y[trace_order[t]], wz1*idz, tj0, tj1, tk0, tk1);
+
+        j0 = std::min(j0, tj0); j1 = std::max(j1, tj1);
+        k0 = std::min(k0, tk0); k1 = std::max(k1, tk1);
+    }
+
+    # pragma omp parallel
+    {
+        std::vector<float> Ts(tnz);
+        std::vector<float> Tr(tnz);
+
+        # pragma omp for collapse(2)
+        for (int k = k0; k < k1; k++)
+        {
+            for (int j = j0; j < j1; j++)
+            {
+                // bilinear weights of this image column inside the decimated table grid
+
+                int gj = j + wx0;
+                int gk = k + wy0;
+
+                int tj, tk;
+
+                float wx = table_weight(gj, image_scale, modeling->nx, tj);
+                float wy = table_weight(gk, image_scale, modeling->ny, tk);
+
+                tj -= tx0;
+                tk -= ty0;
+
+                float w00 = (1.0f - wx)*(1.0f - wy);
+                float w10 = wx*(1.0f - wy);
+                float w01 = (1.0f - wx)*wy;
+                float w11 = wx*wy;
+
+                int corner[4] = {tj*tnz + tk*tnx*tnz, (tj + 1)*tnz + tk*tnx*tnz, tj*tnz + (tk + 1)*tnx*tnz, (tj + 1)*tnz + (tk + 1)*tnx*tnz};
+
+                float weight[4] = {w00, w10, w01, w11};
+
+                int last_slot = -1;
+                int last_table = -1;
+
+                for (int t = first; t < last; t++)
+                {
+                    int trace = trace_order[t];
+
+                    // traces come grouped by receiver, so columns are only interpolated when the table changes
+
+                    if (trace_slot[trace] != last_slot)
+                    {
+                        get_table_column(true, trace_slot[trace], corner, weight, Ts.data());
+
+                        last_slot = trace_slot[trace];
+                    }
+
+                    if (trace_table[trace] != last_table)
+                    {
+                        get_table_column(false, trace_table[trace], corner, weight, Tr.data());
+
+                        last_table = trace_table[trace];
+                    }
+
+                    float * image = h_image + trace_class[trace]*image_size + j*inz + k*inx*inz;
+                    float * seismic = h_seismic + trace_slot[trace]*nt*modeling->max_spread + trace_spread[trace]*nt;
+
+                    float dist_x = powf(gj*idx - trace_cmp_x[trace], 2.0f);
+                    float dist_y = powf(gk*idy - trace_cmp_y[trace], 2.0f);
+
+                    // the taper only exceeds the cutoff below this depth, since sigma grows linearly with depth
+
+                    float min_depth = sqrtf(dist_x / (tan_x*tan_x) + dist_y / (tan_y*tan_y)) / taper_radius;
+
+                    int i0 = (int)std::max(1.0f, std::min((float)(wz1 + 1), ceilf(min_depth / idz)));
+
+                    i0 = std::max(i0, wz0) - wz0;
+
+                    # pragma omp simd
+                    for (int i = i0; i < inz; i++)
+                    {
+                        int iz = table_z[i];
+                        float wz = table_wz[i];
+
+                        float T = (1.0f - wz)*(Ts[iz] + Tr[iz]) + wz*(Ts[iz + 1] + Tr[iz + 1]);
+
+                        float value = expf(-0.5f*(dist_x*sigma_x2[i] + dist_y*sigma_y2[i]));
+
+                        int tId = (int)(T / dt);
+
+                        if (tId < nt) image[i] += value * seismic[tId];
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename word>
+void quantized_column(Quantized<word> &table, int base, int * corner, float * weight, float * column, int n)
+{
+    // every corner column is a whole brick, so it carries a single offset and scale
+
+    float bias = 0.0f;
+    float w[4];
+    word * q[4];
+
+    for (int c = 0; c < 4; c++)
+    {
+        int brick = (base + corner[c]) / table.brick_size;
+
+        bias += weight[c]*table.offset[brick];
+        w[c] = weight[c]*table.scale[brick];
+        q[c] = table.data + base + corner[c];
+    }
+
+    # pragma omp simd
+    for (int i = 0; i < n; i++)
+        column[i] = bias + w[0]*q[0][i] + w[1]*q[1][i] + w[2]*q[2][i] + w[3]*q[3][i];
+}
+
+void Migration::store_table(float * table, bool source, int slot)
+{
+    if (table_bits == 32)
+        std::copy(table, table + table_size, (source ? h_Ts : h_Tr) + slot*table_size);
+    else if (table_bits == 16)
+        (source ? q16_Ts : q16_Tr).encode(table, slot*table_size, table_size);
+    else
+        (source ? q8_Ts : q8_Tr).encode(table, slot*table_size, table_size);
+}
+
+void Migration::get_table_column(bool source, int slot, int * corner, float * weight, float * column)
+{
+    int base = slot*table_size;
+
+    if (table_bits == 16)
+        quantized_column(source ? q16_Ts : q16_Tr, base, corner, weight, column, tnz);
+    else if (table_bits == 8)
+        quantized_column(source ? q8_Ts : q8_Tr, base, corner, weight, column, tnz);
+    else
+    {
+        float * table = (source ? h_Ts : h_Tr) + base;
+
+        # pragma omp simd
+        for (int i = 0; i < tnz; i++)
+            column[i] = weight[0]*table[i + corner[0]] + weight[1]*table[i + corner[1]] + weight[2]*table[i + corner[2]] + weight[3]*table[i + corner[3]];
+    }
 }
 
 void Migration::export_outputs()
 {
-    cudaMemcpy(h_image, d_image, modeling->volsize*sizeof(float), cudaMemcpyDeviceToHost);
-    modeling->reduce_boundary(h_image, f_image);
-    export_binary_float(output_image_folder + "kirchhoff_result_" + std::to_string(modeling->nz) + "x" + std::to_string(modeling->nx) + "x" + std::to_string(modeling->ny) + ".bin", f_image, modeling->nPoints);
+    if (cpu_imaging && (table_bits < 32))
+    {
+        float error = (table_bits == 16) ? std::max(q16_Ts.max_error, q16_Tr.max_error) : std::max(q8_Ts.max_error, q8_Tr.max_error);
+
+        std::cout << "Travel time quantization error bound: " << 2.0f*error << " s (" << (int)(2.0f*error / dt) << " samples)" << std::endl;
+    }
+
+    std::cout << "Workspace high-water mark: " << (workspace.high_water_mark() + modeling->workspace.high_water_mark()) / 1e6 << " MB" << std::endl;
+
+    if (!cpu_imaging) cudaMemcpy(h_image, d_image, offset_classes*image_size*sizeof(float), cudaMemcpyDeviceToHost);
+
+    std::string image_dimensions = std::to_string(inz) + "x" + std::to_string(inx) + "x" + std::to_string(iny);
+
+    if (image_window) 
+        image_dimensions += "_origin_" + std::to_string((int)(wz0*idz)) + "_" + std::to_string((int)(wx0*idx)) + "_" + std::to_string((int)(wy0*idy)) + "m";
+
+    if (offset_classes == 1)
+    {
+        export_binary_float(output_image_folder + "kirchhoff_result_" + image_dimensions + ".bin", h_image, image_size);
+        remove_snapshot();
+        return;
+    }
+
+    // the stack is the sum of the partial images, each class spans max_offset / offset_classes
+
+    float * stack = workspace.get<float>("stack", image_size);
+
+    for (int c = 0; c < offset_classes; c++)
+    {
+        float * partial = h_image + c*image_size;
+
+        # pragma omp parallel for
+        for (int index = 0; index < image_size; index++)
+            stack[index] += partial[index];
+
+        export_binary_float(output_image_folder + "kirchhoff_offset_class_" + std::to_string(c+1) + "_" + image_dimensions + ".bin", partial, image_size);
+    }
+
+    export_binary_float(output_image_folder + "kirchhoff_result_" + image_dimensions + ".bin", stack, image_size);
+
+    remove_snapshot();
+}
+
+void Migration::remove_snapshot()
+{
+    // the image is on disk, a later run of the same setup must start over instead of resuming
+
+    if (streaming_mode) std::remove(snapshot_path().c_str());
+}
+
+__host__ __device__ float table_weight(int g, int scale, int n, int &t)
+{
+    // node t of the decimated table sits on model index t*scale, the last one on n - 1
+
+    int nodes = (n + scale - 2) / scale + 1;
+
+    t = (g / scale < nodes - 2) ? g / scale : nodes - 2;
+
+    int g0 = t*scale;
+    int g1 = (g0 + scale < n - 1) ? g0 + scale : n - 1;
+
+    return (float)(g - g0) / (g1 - g0);
 }
 
-__global__ void cross_correlation(float * Ts, float * Tr, float * image, float * seismic, float aperture_x, float aperture_y, float cmp_x, 
-                                  float cmp_y, int spread, int nxx, int nyy, int nzz, int nb, float dx, float dy, float dz, int nt, float dt)
+__global__ void device_crop_table(float * T, float * table, int tx0, int ty0, int tz0, int tnx, int tny, int tnz, int scale, 
+                                  int nx, int ny, int nz, int nxx, int nzz, int nb)
 {
     int index = blockIdx.x * blockDim.x + threadIdx.x;
 
-    int k = (int) (index / (nxx*nzz));         
-    int j = (int) (index - k*nxx*nzz) / nzz;   
-    int i = (int) (index - j*nzz - k*nxx*nzz); 
+    int k = (int) (index / (tnx*tnz));         
+    int j = (int) (index - k*tnx*tnz) / tnz;   
+    int i = (int) (index - j*tnz - k*tnx*tnz); 
 
-    if ((i > nb) && (i < nzz-nb) && (j > nb) && (j < nxx-nb) && (k > nb) && (k < nyy-nb))
+    if (k < tny)
     {
-        float sigma_x = tanf(aperture_x * M_PI / 180.0f)*(i-nb)*dz;        
-        float sigma_y = tanf(aperture_y * M_PI / 180.0f)*(i-nb)*dz;        
+        int gi = min((i + tz0)*scale, nz - 1);
+        int gj = min((j + tx0)*scale, nx - 1);
+        int gk = min((k + ty0)*scale, ny - 1);
 
-        float par_x = powf(((j-nb)*dx - cmp_x) / (sigma_x + 1e-6f), 2.0f);
-        float par_y = powf(((k-nb)*dy - cmp_y) / (sigma_y + 1e-6f), 2.0f);
+        table[index] = T[(gi + nb) + (gj + nb)*nzz + (gk + nb)*nxx*nzz];
+    }
+}
 
-        float value = expf(-0.5f*(par_x + par_y));
+__device__ float trilinear_time(float * T, int gi, int gj, int gk, int scale, int tx0, int ty0, int tz0, int tnx, int tnz, int nx, int ny, int nz)
+{
+    int i, j, k;
 
-        float T = Ts[index] + Tr[index]; 
-    
-        int tId = (int)(T / dt);
+    float wz = table_weight(gi, scale, nz, i);
+    float wx = table_weight(gj, scale, nx, j);
+    float wy = table_weight(gk, scale, ny, k);
+
+    i -= tz0; j -= tx0; k -= ty0;
+
+    float c00 = (1.0f - wz)*T[i + j*tnz + k*tnx*tnz] + wz*T[(i+1) + j*tnz + k*tnx*tnz];
+    float c10 = (1.0f - wz)*T[i + (j+1)*tnz + k*tnx*tnz] + wz*T[(i+1) + (j+1)*tnz + k*tnx*tnz];
+    float c01 = (1.0f - wz)*T[i + j*tnz + (k+1)*tnx*tnz] + wz*T[(i+1) + j*tnz + (k+1)*tnx*tnz];
+    float c11 = (1.0f - wz)*T[i + (j+1)*tnz + (k+1)*tnx*tnz] + wz*T[(i+1) + (j+1)*tnz + (k+1)*tnx*tnz];
+
+    return (1.0f - wy)*((1.0f - wx)*c00 + wx*c10) + wy*((1.0f - wx)*c01 + wx*c11);
+}
+
+__global__ void cross_correlation(float * Ts, float * Tr, float * image, float * seismic, float tan_x, float tan_y, float taper_radius, float cmp_x, 
+                                  float cmp_y, int spread, int iOffset, int jOffset, int kOffset, int box_nz, int box_nx, int box_ny, int inx, int iny, int inz, 
+                                  int wx0, int wy0, int wz0, float idx, float idy, float idz, int tx0, int ty0, int tz0, int tnx, int tnz, int nx, int ny, int nz, int scale, 
+                                  int nt, float dt)
+{
+    int box_index = blockIdx.x * blockDim.x + threadIdx.x;
+
+    int kb = (int) (box_index / (box_nx*box_nz));         
+    int jb = (int) (box_index - kb*box_nx*box_nz) / box_nz;   
+    int ib = (int) (box_index - jb*box_nz - kb*box_nx*box_nz); 
+
+    int i = ib + iOffset;
+    int j = jb + jOffset;
+    int k = kb + kOffset;
+
+    int gi = i + wz0;
+    int gj = j + wx0;
+    int gk = k + wy0;
+
+    if ((kb < box_ny) && (i < inz) && (j < inx) && (k < iny) && (gi > 0) && (gj > 0) && (gk > 0))
+    {
+        float sigma_x = tan_x*gi*idz;        
+        float sigma_y = tan_y*gi*idz;        
 
-        if (tId < nt) image[index] += value * seismic[tId + spread*nt];
+        float par_x = powf((gj*idx - cmp_x) / (sigma_x + 1e-6f), 2.0f);
+        float par_y = powf((gk*idy - cmp_y) / (sigma_y + 1e-6f), 2.0f);
+
+        if (par_x + par_y <= taper_radius*taper_radius)
+        {
+            float value = expf(-0.5f*(par_x + par_y));
+
+            float T = trilinear_time(Ts, gi, gj, gk, scale, tx0, ty0, tz0, tnx, tnz, nx, ny, nz) + 
+                      trilinear_time(Tr, gi, gj, gk, scale, tx0, ty0, tz0, tnx, tnz, nx, ny, nz); 
+        
+            int tId = (int)(T / dt);
+
+            if (tId < nt) image[i + j*inz + k*inx*inz] += value * seismic[tId + spread*nt];
+        }
     }
 }    
 
+Migration::~Migration()
+{
+    delete[] h_image;
+    delete[] h_table;
+    delete[] h_seismic;
+
+    delete[] h_Ts;
+    delete[] h_Tr;
+
+    q8_Ts.release();
+    q8_Tr.release();
+    q16_Ts.release();
+    q16_Tr.release();
+
+    delete[] sigma_x2;
+    delete[] sigma_y2;
+
+    delete[] table_z;
+    delete[] table_wz;
+
+    cudaFree(d_Ts);
+    cudaFree(d_Tr);
+    cudaFree(d_image);
+    cudaFree(d_seismic);
+
+    delete modeling;
+}
+
+float * Migration::get_image(int * shape)
+{
+    if (!cpu_imaging) cudaMemcpy(h_image, d_image, offset_classes*image_size*sizeof(float), cudaMemcpyDeviceToHost);
+
+    shape[0] = inz;
+    shape[1] = inx;
+    shape[2] = iny;
+    shape[3] = offset_classes;
+
+    return h_image;
+}
+
+Modeling * Migration::get_modeling()
+{
+    return modeling;
+}
@@ -4,6 +4,8 @@
 # include "../modeling/eikonal_iso.cuh"
 # include "../modeling/eikonal_ani.cuh"
 
+# include <thread>
+
 class Migration
 {
 private:
@@ -11,15 +13,74 @@ private:
     int nt; 
     int nBlocks; 
     int nThreads;
+    int depth_bands;
+
+    int trace_block;
+    int table_bits;
+    bool cpu_imaging;
+
+    int resident_shots;
+    bool receiver_major;
+    float table_memory_budget;
+
+    int image_scale;
+    int inx, iny, inz;
+    int image_size;
+
+    bool streaming_mode;
+    int imaged_shots;
+    int snapshot_frequency;
+    float polling_interval;
+    float streaming_timeout;
+
+    bool image_window;
+    int wx0, wy0, wz0;
+    int wx1, wy1, wz1;
+
+    int tx0, ty0, tz0;
+    int tnx, tny, tnz;
+    int table_size;
+
+    float idx, idy, idz;
 
     float dt; 
     float aperture_x;
     float aperture_y;
+    float aperture_cutoff;
+
+    float tan_x;
+    float tan_y;
+    float taper_radius;
     float max_offset;
+    int offset_classes;
 
     float * d_Tr = nullptr;
 
-    float * f_image = nullptr;
+    float * d_Ts = nullptr;
+    float * h_Ts = nullptr;
+    float * h_Tr = nullptr;
+
+    float * h_table = nullptr;
+
+    Quantized<unsigned char> q8_Ts, q8_Tr;
+    Quantized<unsigned short> q16_Ts, q16_Tr;
+
+    float * sigma_x2 = nullptr;
+    float * sigma_y2 = nullptr;
+
+    int * table_z = nullptr;
+    float * table_wz = nullptr;
+
+    std::vector<int> trace_slot;
+    std::vector<int> trace_class;
+    std::vector<int> trace_table;
+    std::vector<int> trace_order;
+    std::vector<int> trace_spread;
+    std::vector<int> trace_receiver;
+
+    std::vector<float> trace_cmp_x;
+    std::vector<float> trace_cmp_y;
+
     float * h_image = nullptr;
     float * d_image = nullptr;
 
@@ -32,29 +93,68 @@ private:
     std::string output_image_folder;
     std::string output_table_folder;
 
+    std::string table_key;
+
+    std::string receiver_table_path();
+
     void show_information();
-    void read_seismic_data();
+    void read_seismic_data(int slot);
     void set_receiver_point();
     void get_receiver_eikonal();
     void run_cross_correlation();
+    void cpu_cross_correlation(int first, int last);
+    void get_resident_shots(int first_shot, int shots);
+    void image_resident_traces();
+
+    void wait_for_shot_data(int shot);
+    std::string snapshot_path();
+
+    bool import_snapshot();
+    void export_snapshot();
+    void remove_snapshot();
+
+    void plan_memory();
+    void set_image_window();
+    void crop_table(float * T, float * table);
+    void store_table(float * table, bool source, int slot);
+    void get_table_column(bool source, int slot, int * corner, float * weight, float * column);
+
+    void get_aperture_footprint(float cmp_x, float cmp_y, float max_depth, int &j0, int &j1, int &k0, int &k1);
     void export_receiver_eikonal();
 
 protected:
 
     Modeling * modeling = nullptr;
 
+    Workspace workspace;
+
     virtual void set_modeling_type() = 0;
     
 public:
     
     std::string parameters;
 
+    virtual ~Migration();
+
     void set_parameters();
     void image_building();
     void export_outputs();
+
+    float * get_image(int * shape);
+
+    Modeling * get_modeling();
 };
 
-__global__ void cross_correlation(float * Ts, float * Tr, float * image, float * seismic, float aperture_x, float aperture_y, float cmp_x, 
-                                  float cmp_y, int spread, int nxx, int nyy, int nzz, int nb, float dx, float dy, float dz, int nt, float dt);
+__host__ __device__ float table_weight(int g, int scale, int n, int &t);
+
+__global__ void device_crop_table(float * T, float * table, int tx0, int ty0, int tz0, int tnx, int tny, int tnz, int scale, 
+                                  int nx, int ny, int nz, int nxx, int nzz, int nb);
+
+__device__ float trilinear_time(float * T, int gi, int gj, int gk, int scale, int tx0, int ty0, int tz0, int tnx, int tnz, int nx, int ny, int nz);
+
+__global__ void cross_correlation(float * Ts, float * Tr, float * image, float * seismic, float tan_x, float tan_y, float taper_radius, float cmp_x, 
+                                  float cmp_y, int spread, int iOffset, int jOffset, int kOffset, int box_nz, int box_nx, int box_ny, int inx, int iny, int inz, 
+                                  int wx0, int wy0, int wz0, float idx, float idy, float idz, int tx0, int ty0, int tz0, int tnx, int tnz, int nx, int ny, int nz, int scale, 
+                                  int nt, float dt);
 
 # endif
\ No newline at end of file
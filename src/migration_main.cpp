@@ -24,6 +24,10 @@ int main(int argc, char **argv)
 
     migration[type]->export_outputs();
 
+    show_peak_memory("migration");
+
+    export_configuration("migration", file);
+
     std::chrono::duration<double> elapsed_seconds = tf - ti;
     std::cout << "\nRun time: " << elapsed_seconds.count() << " s." << std::endl;
     
@@ -1,236 +1,587 @@
 # include "eikonal_ani.cuh"
 
-void Eikonal_ANI::set_stiffness_element(std::string element, uintc * dCij, float &max, float &min)
-{   
+const std::string stiffness_names[Stiffness::ELEMENTS] = {"C11", "C12", "C13", "C14", "C15", "C16", "C22", "C23", "C24", "C25", "C26",
+                                                         "C33", "C34", "C35", "C36", "C44", "C45", "C46", "C55", "C56", "C66", "tilt", "azimuth"};
+
+void Eikonal_ANI::set_conditions()
+{
+    modeling_type = "eikonal_ani";
+    modeling_name = "Modeling type: Anisotropic eikonal solver";
+
+    symmetry = get_symmetry_class();
+
+    max_iterations = std::stoi(catch_parameter("anisotropy_iterations", parameters));
+    time_tolerance = std::stof(catch_parameter("anisotropy_tolerance", parameters));
+    refresh_cosine = cosf(std::stof(catch_parameter("anisotropy_refresh_angle", parameters)) * M_PI / 180.0f);
+
+    if (max_iterations < 1)
+        throw std::invalid_argument("Error: \033[31manisotropy_iterations\033[0;0m must be a positive integer!");
+
+    // only the independent coefficients of each symmetry class are kept on the device
+
+    std::vector<int> elements;
+
+    if (symmetry == ANI_ISO)
+        elements = {Stiffness::C33, Stiffness::C44};
+
+    else if (symmetry == ANI_VTI)
+        elements = {Stiffness::C11, Stiffness::C13, Stiffness::C33, Stiffness::C44, Stiffness::C66};
+
+    else if (symmetry == ANI_TTI)
+        elements = {Stiffness::C11, Stiffness::C13, Stiffness::C33, Stiffness::C44, Stiffness::C66, Stiffness::TILT, Stiffness::AZIMUTH};
+
+    else if (symmetry == ANI_ORTHO)
+        elements = {Stiffness::C11, Stiffness::C12, Stiffness::C13, Stiffness::C22, Stiffness::C23, Stiffness::C33, Stiffness::C44, Stiffness::C55, Stiffness::C66};
+
+    else
+        for (int element = 0; element < Stiffness::TILT; element++) elements.push_back(element);
+
+    for (int element : elements)
+        import_stiffness_element(element);
+}
+
+int Eikonal_ANI::get_symmetry_class()
+{
+    std::string symmetry_name = catch_parameter("anisotropy_symmetry", parameters);
+
+    if (symmetry_name == "iso") return ANI_ISO;
+    if (symmetry_name == "vti") return ANI_VTI;
+    if (symmetry_name == "tti") return ANI_TTI;
+    if (symmetry_name == "ortho") return ANI_ORTHO;
+    if (symmetry_name == "triclinic") return ANI_TRICLINIC;
+
+    if (symmetry_name != "auto")
+        throw std::invalid_argument("Error: \033[31m" + symmetry_name + "\033[0;0m is not a valid anisotropy symmetry!");
+
+    // a tilted model stored as 21 rotated coefficients is detected as triclinic
+
+    std::string Cijkl_folder = catch_parameter("Cijkl_folder", parameters);
+
+    auto load = [&](int element)
+    {
+        std::vector<float> Cij(nPoints);
+        import_binary_float(Cijkl_folder + stiffness_names[element] + ".bin", Cij.data(), nPoints, true);
+        return Cij;
+    };
+
+    std::vector<float> C33 = load(Stiffness::C33);
+
+    float tolerance = 0.0f;
+
+    for (int index = 0; index < nPoints; index++)
+        tolerance = std::max(tolerance, 1e-4f*fabsf(C33[index]));
+
+    auto equal = [&](const std::vector<float> &A, const std::vector<float> &B)
+    {
+        for (int index = 0; index < nPoints; index++)
+            if (fabsf(A[index] - B[index]) > tolerance) return false;
+
+        return true;
+    };
+
+    std::vector<float> zero(nPoints, 0.0f);
+
+    for (int element : {Stiffness::C14, Stiffness::C15, Stiffness::C16, Stiffness::C24, Stiffness::C25, Stiffness::C26,
+                        Stiffness::C34, Stiffness::C35, Stiffness::C36, Stiffness::C45, Stiffness::C46, Stiffness::C56})
+    {
+        if (!equal(load(element), zero)) return ANI_TRICLINIC;
+    }
+
+    std::vector<float> C11 = load(Stiffness::C11);
+    std::vector<float> C13 = load(Stiffness::C13);
+    std::vector<float> C44 = load(Stiffness::C44);
+    std::vector<float> C66 = load(Stiffness::C66);
+
+    std::vector<float> C12(nPoints);
+
+    for (int index = 0; index < nPoints; index++)
+        C12[index] = C11[index] - 2.0f*C66[index];
+
+    bool hexagonal = equal(load(Stiffness::C22), C11) && equal(load(Stiffness::C23), C13) &&
+                     equal(load(Stiffness::C55), C44) && equal(load(Stiffness::C12), C12);
+
+    if (!hexagonal) return ANI_ORTHO;
+
+    if (equal(C33, C11) && equal(C13, C12) && equal(C44, C66)) return ANI_ISO;
+
+    return ANI_VTI;
+}
+
+void Eikonal_ANI::import_stiffness_element(int element)
+{
     std::string Cijkl_folder = catch_parameter("Cijkl_folder", parameters);
 
-    auto * Cij = new float[volsize]();
-    auto * uCij = new uintc[volsize]();
-    auto * Caux = new float[nPoints]();
-    import_binary_float(Cijkl_folder + element + ".bin", Caux, nPoints);
+    float * Cij = workspace.get<float>("stiffness_volume", volsize, false);
+    float * Caux = workspace.get<float>("stiffness_input", nPoints, false);
+
+    import_binary_float(Cijkl_folder + stiffness_names[element] + ".bin", Caux, nPoints, true);
+
     expand_boundary(Caux, Cij);
-    compression(Cij, uCij, volsize, max, min);        
-    cudaMalloc((void**)&(dCij), volsize*sizeof(uintc));
-    cudaMemcpy(dCij, uCij, volsize*sizeof(uintc), cudaMemcpyHostToDevice);
-    delete[] Cij;
-    delete[] uCij;
-    delete[] Caux;
+    set_stiffness_element(element, Cij);
 }
 
-void Eikonal_ANI::set_conditions()
+void Eikonal_ANI::set_stiffness_element(int element, float * input)
 {
-    modeling_type = "eikonal_ani";
-    modeling_name = "Modeling type: Anisotropic eikonal solver";
+    if (stiffness_words.data == nullptr) 
+        stiffness_words.allocate(volsize, volsize);
 
-    set_stiffness_element("C11", d_C11, maxC11, minC11);
-    set_stiffness_element("C12", d_C12, maxC12, minC12);
-    set_stiffness_element("C13", d_C13, maxC13, minC13);
-    set_stiffness_element("C14", d_C14, maxC14, minC14);
-    set_stiffness_element("C15", d_C15, maxC15, minC15);
-    set_stiffness_element("C16", d_C16, maxC16, minC16);
+    stiffness_words.encode(input, 0, volsize);
 
-    set_stiffness_element("C22", d_C22, maxC22, minC22);
-    set_stiffness_element("C23", d_C23, maxC23, minC23);
-    set_stiffness_element("C24", d_C24, maxC24, minC24);
-    set_stiffness_element("C25", d_C25, maxC25, minC25);
-    set_stiffness_element("C26", d_C26, maxC26, minC26);
+    stiffness.scale[element] = stiffness_words.scale[0];
+    stiffness.offset[element] = stiffness_words.offset[0];
 
-    set_stiffness_element("C33", d_C33, maxC33, minC33);
-    set_stiffness_element("C34", d_C34, maxC34, minC34);
-    set_stiffness_element("C35", d_C35, maxC35, minC35);
-    set_stiffness_element("C36", d_C36, maxC36, minC36);
+    if (stiffness.C[element] == nullptr)
+        cudaMalloc((void**)&(stiffness.C[element]), volsize*sizeof(uintc));
 
-    set_stiffness_element("C44", d_C44, maxC44, minC44);
-    set_stiffness_element("C45", d_C45, maxC45, minC45);
-    set_stiffness_element("C46", d_C46, maxC46, minC46);
+    cudaMemcpy(stiffness.C[element], stiffness_words.data, volsize*sizeof(uintc), cudaMemcpyHostToDevice);
+}
 
-    set_stiffness_element("C55", d_C55, maxC55, minC55);
-    set_stiffness_element("C56", d_C56, maxC56, minC56);
+void Eikonal_ANI::get_stiffness_element(int element, float * output)
+{
+    if (stiffness_words.data == nullptr) 
+        stiffness_words.allocate(volsize, volsize);
 
-    set_stiffness_element("C66", d_C66, maxC66, minC66);
+    cudaMemcpy(stiffness_words.data, stiffness.C[element], volsize*sizeof(uintc), cudaMemcpyDeviceToHost);
+
+    stiffness_words.scale[0] = stiffness.scale[element];
+    stiffness_words.offset[0] = stiffness.offset[element];
+
+    stiffness_words.decode(output, 0, volsize);
+}
+
+void Eikonal_ANI::plan_memory()
+{
+    if (domain_decomposition)
+        throw std::invalid_argument("Error: \033[31mdomain decomposition\033[0;0m is only available for the isotropic eikonal solver!");
+
+    Modeling::plan_memory();
+
+    std::string symmetry_name = catch_parameter("anisotropy_symmetry", parameters);
+
+    // auto detection may keep fewer volumes, but reads up to eight inputs at once
+
+    int volumes = Stiffness::TILT;
+
+    if (symmetry_name == "iso") volumes = 2;
+    if (symmetry_name == "vti") volumes = 5;
+    if (symmetry_name == "tti") volumes = 7;
+    if (symmetry_name == "ortho") volumes = 9;
+
+    int inputs = (symmetry_name == "auto") ? 8 : 1;
+
+    // axis slowness, previous times and the three direction cosines of the last refresh
+
+    int iteration_volumes = (symmetry_name == "iso") ? 1 : 5;
+
+    host_bytes += 4.0*volsize*sizeof(float) + volsize*sizeof(uintc) + inputs*nPoints*sizeof(float);
+    device_bytes += volumes*volsize*sizeof(uintc) + iteration_volumes*volsize*sizeof(float);
+}
+
+Modeling * Eikonal_ANI::clone()
+{
+    Eikonal_ANI * worker = new Eikonal_ANI(*this);
+
+    // iteration buffers are per solver, they are allocated on first use
+
+    worker->d_S0 = nullptr;
+    worker->d_P = nullptr;
+    worker->d_Tprev = nullptr;
+    worker->d_change = nullptr;
+
+    worker->stiffness_words = Quantized<uintc>();
+
+    return worker;
+}
+
+Eikonal_ANI::~Eikonal_ANI()
+{
+    cudaFree(d_S0);
+    cudaFree(d_P);
+    cudaFree(d_Tprev);
+    cudaFree(d_change);
+
+    stiffness_words.release();
+
+    // workers read the stiffness words of the solver that created them
+
+    if (shared_buffers) return;
+
+    for (int element = 0; element < Stiffness::ELEMENTS; element++)
+        cudaFree(stiffness.C[element]);
+}
+
+void Eikonal_ANI::copy_slowness_to_device()
+{
+    // the axis slowness stays on the device, each shot restarts from it without a host transfer
+
+    if (d_S0 == nullptr)
+        cudaMalloc((void**)&(d_S0), volsize*sizeof(float));
+
+    cudaMemcpy(d_S0, S, volsize*sizeof(float), cudaMemcpyHostToDevice);
+}
+
+void Eikonal_ANI::update_worker(Modeling * worker)
+{
+    // device stiffness words are shared, but every worker keeps its own scales, offsets and symmetry class
+
+    Eikonal_ANI * eikonal = dynamic_cast<Eikonal_ANI*>(worker);
+
+    eikonal->stiffness = stiffness;
+    eikonal->symmetry = symmetry;
+
+    Modeling::update_worker(worker);
 }
 
 void Eikonal_ANI::time_propagation()
 {
-    initialization();
-    eikonal_solver();
+    cudaMemcpy(d_S, d_S0, volsize*sizeof(float), cudaMemcpyDeviceToDevice);
 
-    get_quasi_slowness<<<nBlocks,nThreads>>>(d_T,d_S,dx,dy,dz,sIdx,sIdy,sIdz,nxx,nyy,nzz,nb,d_C11, 
-                                             d_C12,d_C13,d_C14,d_C15,d_C16,d_C22,d_C23,d_C24,d_C25, 
-                                             d_C26,d_C33,d_C34,d_C35,d_C36,d_C44,d_C45,d_C46,d_C55, 
-                                             d_C56,d_C66,minC11,maxC11,minC12,maxC12,minC13,maxC13,
-                                             minC14,maxC14,minC15,maxC15,minC16,maxC16,minC22,maxC22,
-                                             minC23,maxC23,minC24,maxC24,minC25,maxC25,minC26,maxC26,
-                                             minC33,maxC33,minC34,maxC34,minC35,maxC35,minC36,maxC36,
-                                             minC44,maxC44,minC45,maxC45,minC46,maxC46,minC55,maxC55,
-                                             minC56,maxC56,minC66,maxC66);
-                                             
     initialization();
     eikonal_solver();
 
-    copy_slowness_to_device();
+    // the isotropic qP slowness is the input slowness itself
+
+    if (symmetry == ANI_ISO) return;
+
+    if (d_P == nullptr)
+    {
+        cudaMalloc((void**)&(d_P), 3*volsize*sizeof(float));
+        cudaMalloc((void**)&(d_Tprev), volsize*sizeof(float));
+        cudaMalloc((void**)&(d_change), sizeof(int));
+    }
+
+    for (int iteration = 0; iteration < max_iterations; iteration++)
+    {
+        cudaMemcpy(d_Tprev, d_T, volsize*sizeof(float), cudaMemcpyDeviceToDevice);
+
+        refresh_quasi_slowness(iteration == 0);
+
+        initialization();
+        eikonal_solver();
+
+        if (get_time_change() < time_tolerance) break;
+    }
+}
+
+void Eikonal_ANI::refresh_quasi_slowness(bool full)
+{
+    if (symmetry == ANI_VTI)
+        get_quasi_slowness<ANI_VTI><<<nBlocks,nThreads>>>(d_T,d_S,d_S0,d_P,stiffness,refresh_cosine,full,dx,dy,dz,sIdx,sIdy,sIdz,nxx,nyy,nzz,nb);
+
+    else if (symmetry == ANI_TTI)
+        get_quasi_slowness<ANI_TTI><<<nBlocks,nThreads>>>(d_T,d_S,d_S0,d_P,stiffness,refresh_cosine,full,dx,dy,dz,sIdx,sIdy,sIdz,nxx,nyy,nzz,nb);
+
+    else if (symmetry == ANI_ORTHO)
+        get_quasi_slowness<ANI_ORTHO><<<nBlocks,nThreads>>>(d_T,d_S,d_S0,d_P,stiffness,refresh_cosine,full,dx,dy,dz,sIdx,sIdy,sIdz,nxx,nyy,nzz,nb);
+
+    else
+        get_quasi_slowness<ANI_TRICLINIC><<<nBlocks,nThreads>>>(d_T,d_S,d_S0,d_P,stiffness,refresh_cosine,full,dx,dy,dz,sIdx,sIdy,sIdz,nxx,nyy,nzz,nb);
+}
+
+float Eikonal_ANI::get_time_change()
+{
+    int change = 0;
+
+    cudaMemset(d_change, 0, sizeof(int));
+
+    time_change<<<nBlocks,nThreads>>>(d_T, d_Tprev, d_change, volsize);
+
+    cudaMemcpy(&change, d_change, sizeof(int), cudaMemcpyDeviceToHost);
+
+    float max_change;
+
+    std::memcpy(&max_change, &change, sizeof(float));
+
+    return max_change;
 }
 
 void Eikonal_ANI::get_stiffness_VTI(float * E, float * D)
 {
- 
+    float * C11 = workspace.get<float>("vti_C11", volsize, false);
+    float * C13 = workspace.get<float>("vti_C13", volsize, false);
+    float * C33 = workspace.get<float>("vti_C33", volsize, false);
+    float * C44 = workspace.get<float>("vti_C44", volsize, false);
+
+    get_stiffness_element(Stiffness::C33, C33);
+    get_stiffness_element(Stiffness::C44, C44);
+
+    // an isotropic model becomes a VTI one with null Thomsen parameters
+
+    if (symmetry == ANI_ISO)
+    {
+        # pragma omp parallel for
+        for (int index = 0; index < volsize; index++)
+            C13[index] = C33[index] - 2.0f*C44[index];
+
+        set_stiffness_element(Stiffness::C11, C33);
+        set_stiffness_element(Stiffness::C13, C13);
+        set_stiffness_element(Stiffness::C66, C44);
+
+        symmetry = ANI_VTI;
+    }
+
+    if ((symmetry != ANI_VTI) && (symmetry != ANI_TTI))
+        throw std::invalid_argument("Error: \033[31mThomsen parameters\033[0;0m require a VTI or TTI stiffness model!");
 
+    get_stiffness_element(Stiffness::C11, C11);
+    get_stiffness_element(Stiffness::C13, C13);
+
+    # pragma omp parallel for
+    for (int index = 0; index < volsize; index++)
+    {
+        float c33 = C33[index];
+        float c44 = C44[index];
 
+        C11[index] = (C11[index] - c33) / (2.0f*c33);
+        C13[index] = (powf(C13[index] + c44, 2.0f) - powf(c33 - c44, 2.0f)) / (2.0f*c33*(c33 - c44));
+    }
+
+    reduce_boundary(C11, E);
+    reduce_boundary(C13, D);
 }
 
 void Eikonal_ANI::set_stiffness_VTI(float * E, float * D)
 {
+    float * C11 = workspace.get<float>("vti_C11", volsize, false);
+    float * C13 = workspace.get<float>("vti_C13", volsize, false);
+    float * C33 = workspace.get<float>("vti_C33", volsize, false);
+    float * C44 = workspace.get<float>("vti_C44", volsize, false);
+
+    get_stiffness_element(Stiffness::C33, C33);
+    get_stiffness_element(Stiffness::C44, C44);
 
+    expand_boundary(E, C11);
+    expand_boundary(D, C13);
 
-    
+    # pragma omp parallel for
+    for (int index = 0; index < volsize; index++)
+    {
+        float c33 = C33[index];
+        float c44 = C44[index];
+
+        C11[index] = c33*(1.0f + 2.0f*C11[index]);
+        C13[index] = sqrtf(std::max(0.0f, 2.0f*C13[index]*c33*(c33 - c44) + powf(c33 - c44, 2.0f))) - c44;
+    }
+
+    set_stiffness_element(Stiffness::C11, C11);
+    set_stiffness_element(Stiffness::C13, C13);
 }
 
-__global__ void get_quasi_slowness(float * T, float * S, float dx, float dy, float dz, int sIdx, int sIdy, int sIdz, int nxx, int nyy, int nzz, int nb,
-                                   uintc * C11, uintc * C12, uintc * C13, uintc * C14, uintc * C15, uintc * C16, uintc * C22, uintc * C23, uintc * C24, uintc * C25, 
-                                   uintc * C26, uintc * C33, uintc * C34, uintc * C35, uintc * C36, uintc * C44, uintc * C45, uintc * C46, uintc * C55, uintc * C56, 
-                                   uintc * C66, float minC11, float maxC11, float minC12, float maxC12, float minC13, float maxC13, float minC14, float maxC14, 
-                                   float minC15, float maxC15, float minC16, float maxC16, float minC22, float maxC22, float minC23, float maxC23, float minC24, 
-                                   float maxC24, float minC25, float maxC25, float minC26, float maxC26, float minC33, float maxC33, float minC34, float maxC34, 
-                                   float minC35, float maxC35, float minC36, float maxC36, float minC44, float maxC44, float minC45, float maxC45, float minC46, 
-                                   float maxC46, float minC55, float maxC55, float minC56, float maxC56, float minC66, float maxC66)
+__device__ float vti_eigenvalue(float c11, float c13, float c33, float c44, float c66, float ph2, float pa2)
 {
-    int index = blockIdx.x * blockDim.x + threadIdx.x;
+    // qP and qSV from the 2x2 block along the symmetry axis, SH decoupled
+
+    float G11 = c11*ph2 + c44*pa2;
+    float G33 = c44*ph2 + c33*pa2;
+    float G13 = (c13 + c44)*sqrtf(ph2*pa2);
 
-    int k = (int) (index / (nxx*nzz));         
-    int j = (int) (index - k*nxx*nzz) / nzz;    
-    int i = (int) (index - j*nzz - k*nxx*nzz);  
+    float qP = 0.5f*(G11 + G33 + sqrtf((G11 - G33)*(G11 - G33) + 4.0f*G13*G13));
+    float SH = c66*ph2 + c44*pa2;
 
+    return fmaxf(qP, SH);
+}
+
+template <>
+__device__ float qp_eigenvalue<ANI_ISO>(const Stiffness &C, float * p, int index)
+{
+    return 1.0f;
+}
+
+template <>
+__device__ float qp_eigenvalue<ANI_VTI>(const Stiffness &C, float * p, int index)
+{
+    float c33 = C.get(Stiffness::C33, index);
+
+    float c11 = C.get(Stiffness::C11, index) / c33;
+    float c13 = C.get(Stiffness::C13, index) / c33;
+    float c44 = C.get(Stiffness::C44, index) / c33;
+    float c66 = C.get(Stiffness::C66, index) / c33;
+
+    return vti_eigenvalue(c11, c13, 1.0f, c44, c66, p[0]*p[0] + p[1]*p[1], p[2]*p[2]);
+}
+
+template <>
+__device__ float qp_eigenvalue<ANI_TTI>(const Stiffness &C, float * p, int index)
+{
+    float c33 = C.get(Stiffness::C33, index);
+
+    float c11 = C.get(Stiffness::C11, index) / c33;
+    float c13 = C.get(Stiffness::C13, index) / c33;
+    float c44 = C.get(Stiffness::C44, index) / c33;
+    float c66 = C.get(Stiffness::C66, index) / c33;
+
+    float tilt = C.get(Stiffness::TILT, index) * M_PI / 180.0f;
+    float azimuth = C.get(Stiffness::AZIMUTH, index) * M_PI / 180.0f;
+
+    float pa = p[0]*sinf(tilt)*cosf(azimuth) + p[1]*sinf(tilt)*sinf(azimuth) + p[2]*cosf(tilt);
+
+    return vti_eigenvalue(c11, c13, 1.0f, c44, c66, fmaxf(0.0f, 1.0f - pa*pa), pa*pa);
+}
+
+template <>
+__device__ float qp_eigenvalue<ANI_ORTHO>(const Stiffness &C, float * p, int index)
+{
+    float c33 = C.get(Stiffness::C33, index);
+
+    float c11 = C.get(Stiffness::C11, index) / c33;
+    float c12 = C.get(Stiffness::C12, index) / c33;
+    float c13 = C.get(Stiffness::C13, index) / c33;
+    float c22 = C.get(Stiffness::C22, index) / c33;
+    float c23 = C.get(Stiffness::C23, index) / c33;
+    float c44 = C.get(Stiffness::C44, index) / c33;
+    float c55 = C.get(Stiffness::C55, index) / c33;
+    float c66 = C.get(Stiffness::C66, index) / c33;
+
+    float px2 = p[0]*p[0];
+    float py2 = p[1]*p[1];
+    float pz2 = p[2]*p[2];
+
+    float G[9];
+
+    G[0] = c11*px2 + c66*py2 + c55*pz2;
+    G[4] = c66*px2 + c22*py2 + c44*pz2;
+    G[8] = c55*px2 + c44*py2 + pz2;
+
+    G[1] = G[3] = (c12 + c66)*p[0]*p[1];
+    G[2] = G[6] = (c13 + c55)*p[0]*p[2];
+    G[5] = G[7] = (c23 + c44)*p[1]*p[2];
+
+    return largest_eigenvalue(G);
+}
+
+template <>
+__device__ float qp_eigenvalue<ANI_TRICLINIC>(const Stiffness &C, float * p, int index)
+{
     const int n = 3;
     const int v = 6;
 
-    float p[n];
-    float C[v*v];
     float G[n*n];
-    float Gv[n];
+    float Cv[v*v];
 
     int voigt_map[n][n] = {{0, 5, 4}, {5, 1, 3}, {4, 3, 2}};
 
-    if ((i >= nb) && (i < nzz-nb) && (j >= nb) && (j < nxx-nb) && (k >= nb) && (k < nyy-nb))
+    int element = 0;
+
+    float c33 = C.get(Stiffness::C33, index);
+
+    for (int I = 0; I < v; I++)
     {
-        if (!((i == sIdz) && (j == sIdx) && (k == sIdy)))    
+        for (int J = I; J < v; J++, element++)
         {
-            float dTz = 0.5f*(T[(i+1) + j*nzz + k*nxx*nzz] - T[(i-1) + j*nzz + k*nxx*nzz]) / dz;
-            float dTx = 0.5f*(T[i + (j+1)*nzz + k*nxx*nzz] - T[i + (j-1)*nzz + k*nxx*nzz]) / dx;
-            float dTy = 0.5f*(T[i + j*nzz + (k+1)*nxx*nzz] - T[i + j*nzz + (k-1)*nxx*nzz]) / dy;
+            Cv[I + J*v] = C.get(element, index) / c33;
+            Cv[J + I*v] = Cv[I + J*v];
+        }
+    }
 
-            float norm = sqrtf(dTx*dTx + dTy*dTy + dTz*dTz);
+    for (int indp = 0; indp < n*n; indp++)
+        G[indp] = 0.0f;
 
-            p[0] = dTx / norm;
-            p[1] = dTy / norm;
-            p[2] = dTz / norm;
-            
-            float c11 = (minC11 + (static_cast<float>(C11[index]) - 1.0f) * (maxC11 - minC11) / (COMPRESS - 1));
-            float c12 = (minC12 + (static_cast<float>(C12[index]) - 1.0f) * (maxC12 - minC12) / (COMPRESS - 1));
-            float c13 = (minC13 + (static_cast<float>(C13[index]) - 1.0f) * (maxC13 - minC13) / (COMPRESS - 1));
-            float c14 = (minC14 + (static_cast<float>(C14[index]) - 1.0f) * (maxC14 - minC14) / (COMPRESS - 1));
-            float c15 = (minC15 + (static_cast<float>(C15[index]) - 1.0f) * (maxC15 - minC15) / (COMPRESS - 1));
-            float c16 = (minC16 + (static_cast<float>(C16[index]) - 1.0f) * (maxC16 - minC16) / (COMPRESS - 1));
-
-            float c22 = (minC22 + (static_cast<float>(C22[index]) - 1.0f) * (maxC22 - minC22) / (COMPRESS - 1));
-            float c23 = (minC23 + (static_cast<float>(C23[index]) - 1.0f) * (maxC23 - minC23) / (COMPRESS - 1));
-            float c24 = (minC24 + (static_cast<float>(C24[index]) - 1.0f) * (maxC24 - minC24) / (COMPRESS - 1));
-            float c25 = (minC25 + (static_cast<float>(C25[index]) - 1.0f) * (maxC25 - minC25) / (COMPRESS - 1));
-            float c26 = (minC26 + (static_cast<float>(C26[index]) - 1.0f) * (maxC26 - minC26) / (COMPRESS - 1));
-
-            float c33 = (minC33 + (static_cast<float>(C33[index]) - 1.0f) * (maxC33 - minC33) / (COMPRESS - 1));
-            float c34 = (minC34 + (static_cast<float>(C34[index]) - 1.0f) * (maxC34 - minC34) / (COMPRESS - 1));
-            float c35 = (minC35 + (static_cast<float>(C35[index]) - 1.0f) * (maxC35 - minC35) / (COMPRESS - 1));
-            float c36 = (minC36 + (static_cast<float>(C36[index]) - 1.0f) * (maxC36 - minC36) / (COMPRESS - 1));
-
-            float c44 = (minC44 + (static_cast<float>(C44[index]) - 1.0f) * (maxC44 - minC44) / (COMPRESS - 1));
-            float c45 = (minC45 + (static_cast<float>(C45[index]) - 1.0f) * (maxC45 - minC45) / (COMPRESS - 1));
-            float c46 = (minC46 + (static_cast<float>(C46[index]) - 1.0f) * (maxC46 - minC46) / (COMPRESS - 1));
-
-            float c55 = (minC55 + (static_cast<float>(C55[index]) - 1.0f) * (maxC55 - minC55) / (COMPRESS - 1));
-            float c56 = (minC56 + (static_cast<float>(C56[index]) - 1.0f) * (maxC56 - minC56) / (COMPRESS - 1));
-
-            float c66 = (minC66 + (static_cast<float>(C66[index]) - 1.0f) * (maxC66 - minC66) / (COMPRESS - 1));
-
-            C[0+0*v] = c11; C[0+1*v] = c12; C[0+2*v] = c13; C[0+3*v] = c14; C[0+4*v] = c15; C[0+5*v] = c16;
-            C[1+0*v] = c12; C[1+1*v] = c22; C[1+2*v] = c23; C[1+3*v] = c24; C[1+4*v] = c25; C[1+5*v] = c26;
-            C[2+0*v] = c13; C[2+1*v] = c23; C[2+2*v] = c33; C[2+3*v] = c34; C[2+4*v] = c35; C[2+5*v] = c36;
-            C[3+0*v] = c14; C[3+1*v] = c24; C[3+2*v] = c34; C[3+3*v] = c44; C[3+4*v] = c45; C[3+5*v] = c46;
-            C[4+0*v] = c15; C[4+1*v] = c25; C[4+2*v] = c35; C[4+3*v] = c45; C[4+4*v] = c55; C[4+5*v] = c56;
-            C[5+0*v] = c16; C[5+1*v] = c26; C[5+2*v] = c36; C[5+3*v] = c46; C[5+4*v] = c56; C[5+5*v] = c66;
-
-            float Ro = c33*S[index]*S[index];    
-            
-            for (int indp = 0; indp < v*v; indp++)
-                C[indp] = C[indp] / Ro / Ro;
-
-            for (int indp = 0; indp < n*n; indp++) 
-                G[indp] = 0.0f; 
-
-            for (int ip = 0; ip < n; ip++) 
+    for (int ip = 0; ip < n; ip++)
+    {
+        for (int jp = 0; jp < n; jp++)
+        {
+            for (int kp = 0; kp < n; kp++)
             {
-                for (int jp = 0; jp < n; jp++) 
+                for (int lp = 0; lp < n; lp++)
                 {
-                    for (int kp = 0; kp < n; kp++) 
-                    {
-                        for (int lp = 0; lp < n; lp++) 
-                        {
-                            int I = voigt_map[ip][kp];
-                            int J = voigt_map[jp][lp];
-
-                            G[ip + jp*n] += C[I + J*v]*p[kp]*p[lp];
-                        }
-                    }
+                    int I = voigt_map[ip][kp];
+                    int J = voigt_map[jp][lp];
+
+                    G[ip + jp*n] += Cv[I + J*v]*p[kp]*p[lp];
                 }
             }
+        }
+    }
+
+    return largest_eigenvalue(G);
+}
+
+__device__ float largest_eigenvalue(float * G)
+{
+    float a = -(G[0] + G[4] + G[8]);
 
-            float a = -(G[0] + G[4] + G[8]);
-    
-            float b = G[0]*G[4] + G[4]*G[8] + 
-                      G[0]*G[8] - G[3]*G[1] - 
-                      G[6]*G[6] - G[7]*G[5];
-            
-            float c = -(G[0]*(G[4]*G[8] - G[7]*G[5]) -
-                        G[3]*(G[1]*G[8] - G[7]*G[6]) +
-                        G[6]*(G[1]*G[5] - G[4]*G[6]));
+    float b = G[0]*G[4] + G[4]*G[8] +
+              G[0]*G[8] - G[3]*G[1] -
+              G[6]*G[2] - G[7]*G[5];
 
-            float p = b - (a*a)/3.0f;
-            float q = (2.0f*a*a*a)/27.0f - (a*b)/3.0f + c;
+    float c = -(G[0]*(G[4]*G[8] - G[7]*G[5]) -
+                G[3]*(G[1]*G[8] - G[7]*G[2]) +
+                G[6]*(G[1]*G[5] - G[4]*G[2]));
 
-            float detG = 0.25f*(q*q) + (p*p*p)/27.0f;
+    float p = b - (a*a)/3.0f;
+    float q = (2.0f*a*a*a)/27.0f - (a*b)/3.0f + c;
 
-            if (detG > 0) 
-            {
-                float u = cbrtf(-0.5f*q + sqrtf(detG));
-                float v = cbrtf(-0.5f*q - sqrtf(detG));
-                
-                Gv[0] = u + v - a/3.0f;
-            } 
-            else if (detG == 0) 
-            {       
-                float u = cbrtf(-0.5f*q);
-
-                Gv[0] = 2.0f*u - a/3.0f;
-                Gv[1] =-1.0f*u - a/3.0f;         
-            } 
-            else  
+    float detG = 0.25f*(q*q) + (p*p*p)/27.0f;
+
+    if (detG > 0)
+    {
+        float u = cbrtf(-0.5f*q + sqrtf(detG));
+        float v = cbrtf(-0.5f*q - sqrtf(detG));
+
+        return u + v - a/3.0f;
+    }
+    else if (detG == 0)
+    {
+        float u = cbrtf(-0.5f*q);
+
+        return fmaxf(2.0f*u, -1.0f*u) - a/3.0f;
+    }
+
+    float r = sqrtf(-p*p*p/27.0f);
+    float phi = acosf(fminf(1.0f, fmaxf(-1.0f, -0.5f*q/r)));
+
+    return 2.0f*cbrtf(r)*cosf(phi/3.0f) - a/3.0f;
+}
+
+template <int symmetry>
+__global__ void get_quasi_slowness(float * T, float * S, float * S0, float * P, Stiffness C, float refresh_cosine, bool full, float dx, float dy, 
+                                   float dz, int sIdx, int sIdy, int sIdz, int nxx, int nyy, int nzz, int nb)
+{
+    int index = blockIdx.x * blockDim.x + threadIdx.x;
+
+    int k = (int) (index / (nxx*nzz));
+    int j = (int) (index - k*nxx*nzz) / nzz;
+    int i = (int) (index - j*nzz - k*nxx*nzz);
+
+    int volsize = nxx*nyy*nzz;
+
+    if ((i >= nb) && (i < nzz-nb) && (j >= nb) && (j < nxx-nb) && (k >= nb) && (k < nyy-nb))
+    {
+        if (!((i == sIdz) && (j == sIdx) && (k == sIdy)))
+        {
+            float dTz = 0.5f*(T[(i+1) + j*nzz + k*nxx*nzz] - T[(i-1) + j*nzz + k*nxx*nzz]) / dz;
+            float dTx = 0.5f*(T[i + (j+1)*nzz + k*nxx*nzz] - T[i + (j-1)*nzz + k*nxx*nzz]) / dx;
+            float dTy = 0.5f*(T[i + j*nzz + (k+1)*nxx*nzz] - T[i + j*nzz + (k-1)*nxx*nzz]) / dy;
+
+            float norm = sqrtf(dTx*dTx + dTy*dTy + dTz*dTz);
+
+            float p[3] = {dTx / norm, dTy / norm, dTz / norm};
+
+            // voxels whose ray direction barely turned keep the slowness of the last refresh
+
+            float cosine = p[0]*P[index] + p[1]*P[index + volsize] + p[2]*P[index + 2*volsize];
+
+            if (full || (cosine < refresh_cosine))
             {
-                float r = sqrtf(-p*p*p/27.0f);
-                float phi = acosf(-0.5f*q/r);
-                
-                r = 2.0f*cbrtf(r);
-
-                Gv[0] = r*cosf(phi/3.0f) - a/3.0f;
-                Gv[1] = r*cosf((phi + 2.0f*M_PI)/3.0f) - a/3.0f;  
-                Gv[2] = r*cosf((phi + 4.0f*M_PI)/3.0f) - a/3.0f;      
-            }
-            
-            float aux;
+                P[index] = p[0];
+                P[index + volsize] = p[1];
+                P[index + 2*volsize] = p[2];
+
+                // eigenvalue normalized by C33, whose qP slowness along the axis is the input one
 
-            if (Gv[0] < Gv[1]) {aux = Gv[0]; Gv[0] = Gv[1]; Gv[1] = aux;} 
-            if (Gv[1] < Gv[2]) {aux = Gv[1]; Gv[1] = Gv[2]; Gv[2] = aux;}
-            if (Gv[0] < Gv[1]) {aux = Gv[0]; Gv[0] = Gv[1]; Gv[1] = aux;}    
+                float lambda = qp_eigenvalue<symmetry>(C, p, index);
 
-            S[index] = 1.0f / sqrtf(Gv[0] * Ro);
+                S[index] = S0[index] / sqrtf(lambda);
+            }
         }
     }
 }
+
+__global__ void time_change(float * T, float * Tprev, int * change, int volsize)
+{
+    int index = blockIdx.x * blockDim.x + threadIdx.x;
+
+    // non-negative floats keep their order as integers
+
+    if (index < volsize) atomicMax(change, __float_as_int(fabsf(T[index] - Tprev[index])));
+}
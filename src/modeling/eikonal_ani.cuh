@@ -3,56 +3,88 @@
 
 # include "modeling.cuh"
 
+# define ANI_ISO 0
+# define ANI_VTI 1
+# define ANI_TTI 2
+# define ANI_ORTHO 3
+# define ANI_TRICLINIC 4
+
+// 16 bit stiffness volumes, indexed by Voigt pair plus the TTI symmetry axis angles,
+// each one quantized as a single global brick of Quantized<uintc>
+
+struct Stiffness
+{
+    enum {C11, C12, C13, C14, C15, C16, C22, C23, C24, C25, C26, C33, C34, C35, C36, C44, C45, C46, C55, C56, C66, TILT, AZIMUTH, ELEMENTS};
+
+    uintc * C[ELEMENTS] = {nullptr};
+
+    float scale[ELEMENTS];
+    float offset[ELEMENTS];
+
+    __device__ float get(int element, int index) const
+    {
+        return offset[element] + scale[element]*static_cast<float>(C[element][index]);
+    }
+};
+
 class Eikonal_ANI : public Modeling
 {
 private:
 
-    uintc * d_C11 = nullptr; float maxC11; float minC11;
-    uintc * d_C12 = nullptr; float maxC12; float minC12;
-    uintc * d_C13 = nullptr; float maxC13; float minC13;
-    uintc * d_C14 = nullptr; float maxC14; float minC14;
-    uintc * d_C15 = nullptr; float maxC15; float minC15;
-    uintc * d_C16 = nullptr; float maxC16; float minC16;
+    int symmetry;
+
+    Stiffness stiffness;
 
-    uintc * d_C22 = nullptr; float maxC22; float minC22;
-    uintc * d_C23 = nullptr; float maxC23; float minC23;
-    uintc * d_C24 = nullptr; float maxC24; float minC24;
-    uintc * d_C25 = nullptr; float maxC25; float minC25;
-    uintc * d_C26 = nullptr; float maxC26; float minC26;
+    Quantized<uintc> stiffness_words;
 
-    uintc * d_C33 = nullptr; float maxC33; float minC33;
-    uintc * d_C34 = nullptr; float maxC34; float minC34;
-    uintc * d_C35 = nullptr; float maxC35; float minC35;
-    uintc * d_C36 = nullptr; float maxC36; float minC36;
+    int max_iterations;
+    float time_tolerance;
+    float refresh_cosine;
 
-    uintc * d_C44 = nullptr; float maxC44; float minC44;
-    uintc * d_C45 = nullptr; float maxC45; float minC45;
-    uintc * d_C46 = nullptr; float maxC46; float minC46;
+    float * d_S0 = nullptr;
+    float * d_P = nullptr;
+    float * d_Tprev = nullptr;
 
-    uintc * d_C55 = nullptr; float maxC55; float minC55;
-    uintc * d_C56 = nullptr; float maxC56; float minC56;
+    int * d_change = nullptr;
 
-    uintc * d_C66 = nullptr; float maxC66; float minC66;
+    void refresh_quasi_slowness(bool full);
+
+    float get_time_change();
 
     void set_conditions();
- 
+
+    Modeling * clone();
+
+    void plan_memory();
+
+    int get_symmetry_class();
+
+    void get_stiffness_element(int element, float * output);
+    void set_stiffness_element(int element, float * input);
+    void import_stiffness_element(int element);
+
 public:
 
+    ~Eikonal_ANI();
+
     void time_propagation();
 
+    void copy_slowness_to_device();
+    void update_worker(Modeling * worker);
+
     void set_stiffness_VTI(float * E, float * D);
     void get_stiffness_VTI(float * E, float * D);
-
-    void set_stiffness_element(std::string element, uintc * dCij, float &max, float &min);
 };
 
-__global__ void get_quasi_slowness(float * T, float * S, float dx, float dy, float dz, int sIdx, int sIdy, int sIdz, int nxx, int nyy, int nzz, int nb, 
-                                   uintc * C11, uintc * C12, uintc * C13, uintc * C14, uintc * C15, uintc * C16, uintc * C22, uintc * C23, uintc * C24, uintc * C25, 
-                                   uintc * C26, uintc * C33, uintc * C34, uintc * C35, uintc * C36, uintc * C44, uintc * C45, uintc * C46, uintc * C55, uintc * C56, 
-                                   uintc * C66, float minC11, float maxC11, float minC12, float maxC12, float minC13, float maxC13, float minC14, float maxC14, 
-                                   float minC15, float maxC15, float minC16, float maxC16, float minC22, float maxC22, float minC23, float maxC23, float minC24, 
-                                   float maxC24, float minC25, float maxC25, float minC26, float maxC26, float minC33, float maxC33, float minC34, float maxC34, 
-                                   float minC35, float maxC35, float minC36, float maxC36, float minC44, float maxC44, float minC45, float maxC45, float minC46, 
-                                   float maxC46, float minC55, float maxC55, float minC56, float maxC56, float minC66, float maxC66);
+template <int symmetry>
+__device__ float qp_eigenvalue(const Stiffness &C, float * p, int index);
+
+__device__ float largest_eigenvalue(float * G);
+
+template <int symmetry>
+__global__ void get_quasi_slowness(float * T, float * S, float * S0, float * P, Stiffness C, float refresh_cosine, bool full, float dx, float dy, 
+                                   float dz, int sIdx, int sIdy, int sIdz, int nxx, int nyy, int nzz, int nb);
+
+__global__ void time_change(float * T, float * Tprev, int * change, int volsize);
 
-# endif
\ No newline at end of file
+# endif
@@ -6,6 +6,11 @@ void Eikonal_ISO::set_conditions()
     modeling_name = "Modeling type: Eikonal isotropic solver";
 }
 
+Modeling * Eikonal_ISO::clone()
+{
+    return new Eikonal_ISO(*this);
+}
+
 void Eikonal_ISO::time_propagation()
 {
     initialization();
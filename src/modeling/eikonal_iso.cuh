@@ -9,6 +9,8 @@ private:
 
     void set_conditions();
 
+    Modeling * clone();
+
 public:
 
     void time_propagation();
@@ -12,6 +12,9 @@ void Modeling::set_parameters()
 
     data_folder = catch_parameter("modeling_output_folder", parameters);
 
+    host_budget = std::stod(catch_parameter("host_memory_budget", parameters));
+    device_budget = std::stod(catch_parameter("device_memory_budget", parameters));
+
     nPoints = nx*ny*nz;
 
     geometry = new Geometry();
@@ -38,18 +41,121 @@ void Modeling::set_parameters()
     nThreads = 256;
     nBlocks = (int)((volsize + nThreads - 1) / nThreads);
 
+    set_domain_decomposition();
+
+    plan_memory();
+
+    check_memory_budget("modeling");
+
     set_properties();    
     set_conditions();    
     set_eikonal();
 }
 
+void Modeling::plan_memory()
+{
+    // slowness and travel times on both sides, plus the unpadded model read at setup
+
+    host_bytes = (2.0*volsize + nPoints + max_spread)*sizeof(float);
+    device_bytes = 2.0*volsize*sizeof(float);
+
+    // only the bricks in flight live on the device, each thread stages its travel times
+
+    if (domain_decomposition)
+    {
+        double brick_volume = (double)(brick_nxx)*brick_nyy*nzz;
+
+        host_bytes += brick_threads*brick_volume*sizeof(float);
+        device_bytes = brick_threads*2.0*brick_volume*sizeof(float);
+    }
+}
+
+void Modeling::set_domain_decomposition()
+{
+    bricks_x = std::stoi(catch_parameter("domain_bricks_x", parameters));
+    bricks_y = std::stoi(catch_parameter("domain_bricks_y", parameters));
+    brick_halo = std::stoi(catch_parameter("domain_halo", parameters));
+    brick_threads = std::stoi(catch_parameter("domain_threads", parameters));
+    max_exchanges = std::stoi(catch_parameter("domain_max_exchanges", parameters));
+    exchange_tolerance = std::stof(catch_parameter("domain_tolerance", parameters));
+
+    domain_decomposition = (bricks_x*bricks_y > 1);
+
+    if (!domain_decomposition) return;
+
+    // bricks split the padded grid laterally, the halo overlaps each neighbor core
+
+    if ((bricks_x < 1) || (bricks_y < 1) || (brick_threads < 1) || (max_exchanges < 1))
+        throw std::invalid_argument("Error: \033[31mdomain decomposition\033[0;0m needs positive brick, thread and exchange counts!");
+
+    if ((brick_halo < 2) || (brick_halo > nxx / bricks_x) || (brick_halo > nyy / bricks_y))
+        throw std::invalid_argument("Error: \033[31mdomain_halo\033[0;0m must lie between 2 and the smallest brick width!");
+
+    brick_x0.resize(bricks_x); brick_x1.resize(bricks_x);
+    brick_y0.resize(bricks_y); brick_y1.resize(bricks_y);
+
+    brick_nxx = 0;
+    brick_nyy = 0;
+
+    for (int b = 0; b < bricks_x; b++)
+    {
+        brick_x0[b] = b*nxx / bricks_x;
+        brick_x1[b] = (b + 1)*nxx / bricks_x;
+
+        brick_nxx = std::max(brick_nxx, std::min(nxx, brick_x1[b] + brick_halo) - std::max(0, brick_x0[b] - brick_halo));
+    }
+
+    for (int b = 0; b < bricks_y; b++)
+    {
+        brick_y0[b] = b*nyy / bricks_y;
+        brick_y1[b] = (b + 1)*nyy / bricks_y;
+
+        brick_nyy = std::max(brick_nyy, std::min(nyy, brick_y1[b] + brick_halo) - std::max(0, brick_y0[b] - brick_halo));
+    }
+
+    brick_active.assign(bricks_x*bricks_y, 0);
+}
+
+void Modeling::allocate_bricks()
+{
+    int brick_volume = brick_nxx*brick_nyy*nzz;
+
+    h_brick_T = new float * [brick_threads];
+    d_brick_T = new float * [brick_threads];
+    d_brick_S = new float * [brick_threads];
+
+    for (int slot = 0; slot < brick_threads; slot++)
+    {
+        h_brick_T[slot] = new float[brick_volume]();
+
+        cudaMalloc((void**)&(d_brick_T[slot]), brick_volume*sizeof(float));
+        cudaMalloc((void**)&(d_brick_S[slot]), brick_volume*sizeof(float));
+    }
+}
+
+bool Modeling::fits_memory_budget()
+{
+    bool host_fits = (host_budget <= 0.0) || (host_bytes <= host_budget*1e6);
+    bool device_fits = (device_budget <= 0.0) || (device_bytes <= device_budget*1e6);
+
+    return host_fits && device_fits;
+}
+
+void Modeling::check_memory_budget(std::string stage)
+{
+    std::cout << "Memory plan for " << stage << ": host " << host_bytes / 1e6 << " MB, device " << device_bytes / 1e6 << " MB" << std::endl;
+
+    if (!fits_memory_budget())
+        throw std::invalid_argument("Error: \033[31m" + stage + "\033[0;0m does not fit the configured memory budget!");
+}
+
 void Modeling::set_properties()
 {
     float * vp = new float[nPoints]();
 
     std::string vp_file = catch_parameter("vp_model_file", parameters);
 
-    import_binary_float(vp_file, vp, nPoints);
+    import_binary_float(vp_file, vp, nPoints, true);
 
     # pragma omp parallel for
     for (int index = 0; index < nPoints; index++)
@@ -93,8 +199,13 @@ void Modeling::set_eikonal()
 
     T = new float[volsize]();
 
-    cudaMalloc((void**)&(d_T), volsize*sizeof(float));
-    cudaMalloc((void**)&(d_S), volsize*sizeof(float));
+    if (domain_decomposition)
+        allocate_bricks();
+    else
+    {
+        cudaMalloc((void**)&(d_T), volsize*sizeof(float));
+        cudaMalloc((void**)&(d_S), volsize*sizeof(float));
+    }
 
     cudaMalloc((void**)&(d_sgnv), NSWEEPS*MESHDIM*sizeof(int));
     cudaMalloc((void**)&(d_sgnt), NSWEEPS*MESHDIM*sizeof(int));
@@ -124,7 +235,60 @@ void Modeling::initialization()
     sIdy = (int)((sy + 0.5f*dy) / dy) + nb;
     sIdz = (int)((sz + 0.5f*dz) / dz) + nb;
 
-    time_set<<<nBlocks,nThreads>>>(d_T, volsize);
+    if (domain_decomposition)
+    {
+        // travel times stay on the host, only the bricks reached by the front are swept first
+
+        if (T_warm != nullptr)
+        {
+            # pragma omp parallel for
+            for (int index = 0; index < volsize; index++)
+                T[index] = (T_warm[index] >= t_warm) ? 1e6f : T_warm[index];
+
+            brick_active.assign(bricks_x*bricks_y, 1);
+
+            T_warm = nullptr;
+        }
+        else
+        {
+            std::fill(T, T + volsize, 1e6f);
+
+            brick_active.assign(bricks_x*bricks_y, 0);
+
+            int bx = 0; while (sIdx >= brick_x1[bx]) bx++;
+            int by = 0; while (sIdy >= brick_y1[by]) by++;
+
+            brick_active[bx + by*bricks_x] = 1;
+        }
+
+        for (int yi = sIdy - 1; yi <= sIdy + 1; yi++)
+        {
+            for (int xi = sIdx - 1; xi <= sIdx + 1; xi++)
+            {
+                for (int zi = sIdz - 1; zi <= sIdz + 1; zi++)
+                {
+                    int index = zi + xi*nzz + yi*nxx*nzz;
+
+                    T[index] = S[index] * sqrtf(powf((xi - nb)*dx - sx, 2.0f) + 
+                                                powf((yi - nb)*dy - sy, 2.0f) +
+                                                powf((zi - nb)*dz - sz, 2.0f));
+                }
+            }
+        }
+
+        return;
+    }
+
+    if (T_warm != nullptr)
+    {
+        cudaMemcpy(d_T, T_warm, volsize*sizeof(float), cudaMemcpyHostToDevice);
+
+        time_reset<<<nBlocks,nThreads>>>(d_T, t_warm, volsize);
+
+        T_warm = nullptr;
+    }
+    else 
+        time_set<<<nBlocks,nThreads>>>(d_T, volsize);
 
     dim3 grid(1,1,1);
     dim3 block(MESHDIM,MESHDIM,MESHDIM);
@@ -134,23 +298,137 @@ void Modeling::initialization()
 
 void Modeling::eikonal_solver()
 {
+    if (domain_decomposition) 
+        decomposed_solver();
+    else
+        eikonal_sweep(d_S, d_T, nxx, nyy, nzz);
+}
+
+void Modeling::decomposed_solver()
+{
+    // the cores are disjoint and a halo never reaches past the neighbor core, so bricks of one 
+    // color only read cores of the other colors, which stay untouched while this color runs.
+    // Halos overlap those cores and pick up their latest times as the colors alternate.
+
+    int exchange = 0;
+
+    float largest_change = 0.0f;
+
+    while ((exchange < max_exchanges) && std::count(brick_active.begin(), brick_active.end(), 1))
+    {
+        largest_change = 0.0f;
+
+        for (int color = 0; color < 4; color++)
+        {
+            std::vector<int> bricks;
+
+            for (int by = color / 2; by < bricks_y; by += 2)
+                for (int bx = color % 2; bx < bricks_x; bx += 2)
+                    if (brick_active[bx + by*bricks_x]) bricks.push_back(bx + by*bricks_x);
+
+            std::vector<float> change(bricks.size());
+
+            # pragma omp parallel for num_threads(brick_threads) schedule(dynamic)
+            for (int n = 0; n < bricks.size(); n++)
+                change[n] = solve_brick(bricks[n] % bricks_x, bricks[n] / bricks_x, omp_get_thread_num());
+
+            for (int n = 0; n < bricks.size(); n++)
+            {
+                brick_active[bricks[n]] = 0;
+
+                largest_change = std::max(largest_change, change[n]);
+
+                if (change[n] <= exchange_tolerance) continue;
+
+                int bx = bricks[n] % bricks_x;
+                int by = bricks[n] / bricks_x;
+
+                for (int cy = std::max(0, by - 1); cy <= std::min(bricks_y - 1, by + 1); cy++)
+                    for (int cx = std::max(0, bx - 1); cx <= std::min(bricks_x - 1, bx + 1); cx++)
+                        brick_active[cx + cy*bricks_x] = 1;
+            }
+        }
+
+        exchange++;
+    }
+
+    int remaining = std::count(brick_active.begin(), brick_active.end(), 1);
+
+    if (remaining > 0)
+    {
+        std::cerr << "Domain decomposition: \033[31m" << remaining << " bricks\033[0;0m still active after " << max_exchanges 
+                  << " exchanges, largest time change " << largest_change << " s (tolerance " << exchange_tolerance << " s)" << std::endl;
+    }
+}
+
+float Modeling::solve_brick(int bx, int by, int slot)
+{
+    int x0 = std::max(0, brick_x0[bx] - brick_halo);
+    int y0 = std::max(0, brick_y0[by] - brick_halo);
+
+    int mxx = std::min(nxx, brick_x1[bx] + brick_halo) - x0;
+    int myy = std::min(nyy, brick_y1[by] + brick_halo) - y0;
+
+    // each y slice of the brick is one contiguous run of the global volume
+
+    size_t pitch = nxx*nzz*sizeof(float);
+    size_t width = mxx*nzz*sizeof(float);
+
+    int offset = x0*nzz + y0*nxx*nzz;
+
+    cudaMemcpy2D(d_brick_S[slot], width, S + offset, pitch, width, myy, cudaMemcpyHostToDevice);
+    cudaMemcpy2D(d_brick_T[slot], width, T + offset, pitch, width, myy, cudaMemcpyHostToDevice);
+
+    eikonal_sweep(d_brick_S[slot], d_brick_T[slot], mxx, myy, nzz);
+
+    cudaMemcpy(h_brick_T[slot], d_brick_T[slot], mxx*myy*nzz*sizeof(float), cudaMemcpyDeviceToHost);
+
+    // the halo is owned by the neighbors, only the core is merged back
+
+    float change = 0.0f;
+
+    for (int k = brick_y0[by]; k < brick_y1[by]; k++)
+    {
+        for (int j = brick_x0[bx]; j < brick_x1[bx]; j++)
+        {
+            float * brick = h_brick_T[slot] + (j - x0)*nzz + (k - y0)*mxx*nzz;
+            float * global = T + j*nzz + k*nxx*nzz;
+
+            for (int i = 0; i < nzz; i++)
+            {
+                if (brick[i] < global[i])
+                {
+                    change = std::max(change, global[i] - brick[i]);
+                    global[i] = brick[i];
+                }
+            }
+        }
+    }
+
+    return change;
+}
+
+void Modeling::eikonal_sweep(float * S, float * T, int mxx, int myy, int mzz, int shots)
+{
+    int levels = (mxx - 1) + (myy - 1) + (mzz - 1);
+
     for (int sweep = 0; sweep < NSWEEPS; sweep++)
     { 
-	    int start = (sweep == 3 || sweep == 5 || sweep == 6 || sweep == 7) ? total_levels : MESHDIM;
-	    int end = (start == MESHDIM) ? total_levels + 1 : MESHDIM - 1;
+	    int start = (sweep == 3 || sweep == 5 || sweep == 6 || sweep == 7) ? levels : MESHDIM;
+	    int end = (start == MESHDIM) ? levels + 1 : MESHDIM - 1;
 	    int incr = (start == MESHDIM) ? true : false;
 
-	    int xSweepOff = (sweep == 3 || sweep == 4) ? nxx : 0;
-	    int ySweepOff = (sweep == 2 || sweep == 5) ? nyy : 0;
-	    int zSweepOff = (sweep == 1 || sweep == 6) ? nzz : 0;
+	    int xSweepOff = (sweep == 3 || sweep == 4) ? mxx : 0;
+	    int ySweepOff = (sweep == 2 || sweep == 5) ? myy : 0;
+	    int zSweepOff = (sweep == 1 || sweep == 6) ? mzz : 0;
 		
 	    for (int level = start; level != end; level = (incr) ? level + 1 : level - 1)
 	    {			
-            int xs = max(1, level - (nyy + nzz));	
-            int ys = max(1, level - (nxx + nzz));
+            int xs = max(1, level - (myy + mzz));	
+            int ys = max(1, level - (mxx + mzz));
             
-            int xe = min(nxx, level - (MESHDIM - 1));
-            int ye = min(nyy, level - (MESHDIM - 1));	
+            int xe = min(mxx, level - (MESHDIM - 1));
+            int ye = min(myy, level - (MESHDIM - 1));	
             
             int xr = xe - xs + 1;
             int yr = ye - ys + 1;
@@ -167,9 +445,14 @@ void Modeling::eikonal_solver()
             int sgnj = sweep + 1*NSWEEPS;
             int sgnk = sweep + 2*NSWEEPS;
 
-            inner_sweep<<<gs, bs>>>(d_S, d_T, d_sgnt, d_sgnv, sgni, sgnj, sgnk, level, xs, ys, 
-                                    xSweepOff, ySweepOff, zSweepOff, nxx, nyy, nzz, dx, dy, dz, 
-                                    dx2i, dy2i, dz2i, dz2dx2, dz2dy2, dx2dy2, dsum);
+            if (shots > 1)
+                inner_sweep_batch<<<gs, bs>>>(S, T, d_sgnt, d_sgnv, sgni, sgnj, sgnk, level, xs, ys, 
+                                              xSweepOff, ySweepOff, zSweepOff, mxx, myy, mzz, dx, dy, dz, 
+                                              dx2i, dy2i, dz2i, dz2dx2, dz2dy2, dx2dy2, dsum, shots, mxx*myy*mzz);
+            else
+                inner_sweep<<<gs, bs>>>(S, T, d_sgnt, d_sgnv, sgni, sgnj, sgnk, level, xs, ys, 
+                                        xSweepOff, ySweepOff, zSweepOff, mxx, myy, mzz, dx, dy, dz, 
+                                        dx2i, dy2i, dz2i, dz2dx2, dz2dy2, dx2dy2, dsum);
 	    }
     }
 }
@@ -178,45 +461,44 @@ void Modeling::compute_seismogram()
 {
     int spread = 0;
 
-    float P[4][4][4];
-
-    cudaMemcpy(T, d_T, volsize*sizeof(float), cudaMemcpyDeviceToHost);    
+    copy_time_to_host();
 
     for (recId = geometry->iRec[srcId]; recId < geometry->fRec[srcId]; recId++)
-    {
-        float x = geometry->xrec[recId];
-        float y = geometry->yrec[recId];
-        float z = geometry->zrec[recId];
+        seismogram[spread++] = get_travel_time(geometry->xrec[recId], geometry->yrec[recId], geometry->zrec[recId]);
+}
+
+float Modeling::get_travel_time(float x, float y, float z)
+{
+    float P[4][4][4];
 
-        float x0 = floorf(x / dx) * dx;
-        float y0 = floorf(y / dy) * dy;
-        float z0 = floorf(z / dz) * dz;
+    float x0 = floorf(x / dx) * dx;
+    float y0 = floorf(y / dy) * dy;
+    float z0 = floorf(z / dz) * dz;
 
-        float x1 = floorf(x / dx) * dx + dx;
-        float y1 = floorf(y / dy) * dy + dy;
-        float z1 = floorf(z / dz) * dz + dz;
+    float x1 = floorf(x / dx) * dx + dx;
+    float y1 = floorf(y / dy) * dy + dy;
+    float z1 = floorf(z / dz) * dz + dz;
 
-        float xd = (x - x0) / (x1 - x0);
-        float yd = (y - y0) / (y1 - y0);
-        float zd = (z - z0) / (z1 - z0);
+    float xd = (x - x0) / (x1 - x0);
+    float yd = (y - y0) / (y1 - y0);
+    float zd = (z - z0) / (z1 - z0);
 
-        int i = (int)(z / dz) + nb; 
-        int j = (int)(x / dx) + nb;   
-        int k = (int)(y / dy) + nb;         
+    int i = (int)(z / dz) + nb; 
+    int j = (int)(x / dx) + nb;   
+    int k = (int)(y / dy) + nb;         
 
-        for (int pIdx = 0; pIdx < 4; pIdx++)
+    for (int pIdx = 0; pIdx < 4; pIdx++)
+    {
+        for (int pIdy = 0; pIdy < 4; pIdy++)
         {
-            for (int pIdy = 0; pIdy < 4; pIdy++)
-            {
-                for (int pIdz = 0; pIdz < 4; pIdz++)
-                {    
-                    P[pIdx][pIdy][pIdz] = T[(i + pIdz - 1) + (j + pIdx - 1)*nzz + (k + pIdy - 1)*nxx*nzz];
-                }
+            for (int pIdz = 0; pIdz < 4; pIdz++)
+            {    
+                P[pIdx][pIdy][pIdz] = T[(i + pIdz - 1) + (j + pIdx - 1)*nzz + (k + pIdy - 1)*nxx*nzz];
             }
-        }   
+        }
+    }   
 
-        seismogram[spread++] = cubic3d(P, xd, yd, zd);
-    }
+    return cubic3d(P, xd, yd, zd);
 }
 
 float Modeling::cubic1d(float P[4], float dx)
@@ -248,8 +530,173 @@ void Modeling::export_seismogram()
 {   
     compute_seismogram();
          
-    std::string data_file = data_folder + modeling_type + "_nStations" + std::to_string(geometry->spread[srcId]) + "_shot_" + std::to_string(geometry->sInd[srcId]+1) + ".bin";
-    export_binary_float(data_file, seismogram, geometry->spread[srcId]);    
+    export_binary_float(seismogram_file(), seismogram, geometry->spread[srcId]);    
+}
+
+std::string Modeling::seismogram_file()
+{
+    return data_folder + modeling_type + "_nStations" + std::to_string(geometry->spread[srcId]) + "_shot_" + std::to_string(geometry->sInd[srcId]+1) + ".bin";
+}
+
+void Modeling::set_reciprocity()
+{
+    std::string mode = catch_parameter("reciprocity", parameters);
+
+    if ((mode != "auto") && (mode != "true") && (mode != "false"))
+        throw std::invalid_argument("Error: \033[31mreciprocity\033[0;0m must be true, false or auto!");
+
+    // receivers sharing a position are solved once
+
+    std::map<std::tuple<float,float,float>, int> stations;
+
+    std::vector<int> rec_station(geometry->nrec, -1);
+
+    station_rec.clear();
+
+    for (int rel = 0; rel < geometry->nrel; rel++)
+    {
+        for (int rec = geometry->iRec[rel]; rec < geometry->fRec[rel]; rec++)
+        {
+            if (rec_station[rec] >= 0) continue;
+
+            auto position = std::make_tuple(geometry->xrec[rec], geometry->yrec[rec], geometry->zrec[rec]);
+
+            auto station = stations.find(position);
+
+            if (station == stations.end())
+            {
+                station = stations.emplace(position, station_rec.size()).first;
+                station_rec.push_back(rec);
+            }
+
+            rec_station[rec] = station->second;
+        }
+    }
+
+    nStations = station_rec.size();
+
+    reciprocity = (mode == "true") || ((mode == "auto") && (nStations < geometry->nrel));
+
+    if (!reciprocity) return;
+
+    // each trace keeps its place in the shot gathers, stations list the traces they fill
+
+    trace_first.assign(geometry->nrel + 1, 0);
+
+    for (int rel = 0; rel < geometry->nrel; rel++)
+        trace_first[rel + 1] = trace_first[rel] + geometry->spread[rel];
+
+    trace_shot.assign(trace_first[geometry->nrel], 0);
+    station_traces.assign(nStations, std::vector<int>());
+
+    for (int rel = 0; rel < geometry->nrel; rel++)
+    {
+        for (int rec = geometry->iRec[rel]; rec < geometry->fRec[rel]; rec++)
+        {
+            int trace = trace_first[rel] + rec - geometry->iRec[rel];
+
+            trace_shot[trace] = rel;
+            station_traces[rec_station[rec]].push_back(trace);
+        }
+    }
+
+    gathers = new float[trace_first[geometry->nrel]]();
+
+    host_bytes += trace_first[geometry->nrel]*(sizeof(float) + sizeof(int)) + nStations*sizeof(int);
+
+    check_memory_budget("reciprocity");
+
+    std::cout << "Reciprocity: " << nStations << " receiver solves replace " << geometry->nrel << " shot solves" << std::endl;
+}
+
+void Modeling::set_shot_batch()
+{
+    shot_batch = std::stoi(catch_parameter("shot_batch", parameters));
+
+    if (shot_batch < 1)
+        throw std::invalid_argument("Error: \033[31mshot_batch\033[0;0m must be a positive integer!");
+
+    batch_sx.assign(shot_batch, 0.0f);
+    batch_sy.assign(shot_batch, 0.0f);
+    batch_sz.assign(shot_batch, 0.0f);
+
+    if (shot_batch == 1) return;
+
+    // only the isotropic slowness is shared by every shot of a batch
+
+    if ((modeling_type != "eikonal_iso") || domain_decomposition)
+        throw std::invalid_argument("Error: \033[31mshot_batch\033[0;0m above one needs the isotropic solver on the whole model!");
+
+    device_bytes += shot_batch*volsize*sizeof(float);
+
+    check_memory_budget("shot batch");
+
+    cudaMalloc((void**)&(d_TB), shot_batch*volsize*sizeof(float));
+}
+
+void Modeling::add_batch_point(int slot)
+{
+    batch_sx[slot] = sx;
+    batch_sy[slot] = sy;
+    batch_sz[slot] = sz;
+}
+
+void Modeling::batch_propagation(int count)
+{
+    if (shot_batch == 1) 
+    {
+        time_propagation();
+        return;
+    }
+
+    dim3 grid(1,1,1);
+    dim3 block(MESHDIM,MESHDIM,MESHDIM);
+
+    for (int slot = 0; slot < count; slot++)
+    {
+        int idx = (int)((batch_sx[slot] + 0.5f*dx) / dx) + nb;
+        int idy = (int)((batch_sy[slot] + 0.5f*dy) / dy) + nb;
+        int idz = (int)((batch_sz[slot] + 0.5f*dz) / dz) + nb;
+
+        time_set<<<nBlocks,nThreads>>>(d_TB + slot*volsize, volsize);
+
+        time_init<<<grid,block>>>(d_TB + slot*volsize,d_S,batch_sx[slot],batch_sy[slot],batch_sz[slot],dx,dy,dz,idx,idy,idz,nxx,nzz,nb);
+    }
+
+    eikonal_sweep(d_S, d_TB, nxx, nyy, nzz, count);
+}
+
+void Modeling::get_batch_time(int slot)
+{
+    if (shot_batch > 1)
+        cudaMemcpy(d_T, d_TB + slot*volsize, volsize*sizeof(float), cudaMemcpyDeviceToDevice);
+}
+
+void Modeling::set_station_point()
+{
+    recId = station_rec[stationId];
+
+    sx = geometry->xrec[recId];
+    sy = geometry->yrec[recId];
+    sz = geometry->zrec[recId];
+}
+
+void Modeling::compute_reciprocal_traces()
+{
+    copy_time_to_host();
+
+    for (auto trace : station_traces[stationId])
+    {
+        int source = geometry->sInd[trace_shot[trace]];
+
+        gathers[trace] = get_travel_time(geometry->xsrc[source], geometry->ysrc[source], geometry->zsrc[source]);
+    }
+}
+
+void Modeling::export_reciprocal_seismograms()
+{
+    for (srcId = 0; srcId < geometry->nrel; srcId++)
+        export_binary_float(seismogram_file(), gathers + trace_first[srcId], geometry->spread[srcId]);
 }
 
 void Modeling::expand_boundary(float * input, float * output)
@@ -324,40 +771,110 @@ void Modeling::show_information()
 
     std::cout << "Model dimensions: (z = " << (nz - 1)*dz << ", x = " << (nx - 1) * dx <<", y = " << (ny - 1) * dy << ") m\n\n";
 
-    std::cout << "Running shot " << srcId + 1 << " of " << geometry->nrel << " in total\n\n";
+    if (reciprocity)
+    {
+        std::cout << "Running receiver station " << stationId + 1 << " of " << nStations << " in total\n\n";
 
-    std::cout << "Current shot position: (z = " << geometry->zsrc[geometry->sInd[srcId]] << 
-                                       ", x = " << geometry->xsrc[geometry->sInd[srcId]] << 
-                                       ", y = " << geometry->ysrc[geometry->sInd[srcId]] << ") m\n\n";
+        std::cout << "Current station position: (z = " << sz << ", x = " << sx << ", y = " << sy << ") m\n\n";
+    }
+    else
+    {
+        std::cout << "Running shot " << srcId + 1 << " of " << geometry->nrel << " in total\n\n";
+
+        std::cout << "Current shot position: (z = " << geometry->zsrc[geometry->sInd[srcId]] << 
+                                           ", x = " << geometry->xsrc[geometry->sInd[srcId]] << 
+                                           ", y = " << geometry->ysrc[geometry->sInd[srcId]] << ") m\n\n";
+    }
 
     std::cout << modeling_name << "\n";
 }
 
-void Modeling::compression(float * input, uintc * output, int volsize, float &max_value, float &min_value)
+int Modeling::iDivUp(int a, int b) 
+{ 
+    return ( (a % b) != 0 ) ? (a / b + 1) : (a / b); 
+}
+
+void Modeling::copy_slowness_to_device()
 {
-    max_value =-1e20f;
-    min_value = 1e20f;
-    
-    # pragma omp parallel for
-    for (int index = 0; index < volsize; index++)
+    if (!domain_decomposition) 
+        cudaMemcpy(d_S, S, volsize * sizeof(float), cudaMemcpyHostToDevice);
+}
+
+void Modeling::update_worker(Modeling * worker)
+{
+    // workers share the host slowness, only their device copy has to follow a model update
+
+    worker->copy_slowness_to_device();
+}
+
+void Modeling::copy_time_to_host()
+{
+    if (!domain_decomposition)
+        cudaMemcpy(T, d_T, volsize*sizeof(float), cudaMemcpyDeviceToHost);
+}
+
+Modeling * Modeling::create_worker()
+{
+    Modeling * worker = clone();
+
+    worker->shared_buffers = true;
+    worker->T_warm = nullptr;
+
+    worker->T = new float[volsize]();
+    worker->seismogram = new float[max_spread]();
+
+    if (domain_decomposition)
+        worker->allocate_bricks();
+    else
     {
-        min_value = std::min(input[index], min_value);
-        max_value = std::max(input[index], max_value);        
+        cudaMalloc((void**)&(worker->d_T), volsize*sizeof(float));
+        cudaMalloc((void**)&(worker->d_S), volsize*sizeof(float));
     }
 
-    # pragma omp parallel for
-    for (int index = 0; index < volsize; index++)
-        output[index] = static_cast<uintc>(1.0f + (COMPRESS - 1)*(input[index] - min_value) / (max_value - min_value));
+    worker->copy_slowness_to_device();
+
+    return worker;
 }
 
-int Modeling::iDivUp(int a, int b) 
-{ 
-    return ( (a % b) != 0 ) ? (a / b + 1) : (a / b); 
+Modeling::~Modeling()
+{
+    delete[] T;
+    delete[] seismogram;
+
+    cudaFree(d_T);
+    cudaFree(d_S);
+
+    if (h_brick_T != nullptr)
+    {
+        for (int slot = 0; slot < brick_threads; slot++)
+        {
+            delete[] h_brick_T[slot];
+
+            cudaFree(d_brick_T[slot]);
+            cudaFree(d_brick_S[slot]);
+        }
+
+        delete[] h_brick_T;
+        delete[] d_brick_T;
+        delete[] d_brick_S;
+    }
+
+    if (shared_buffers) return;
+
+    delete[] S;
+    delete[] gathers;
+
+    delete geometry;
+
+    cudaFree(d_TB);
+    cudaFree(d_sgnv);
+    cudaFree(d_sgnt);
 }
 
-void Modeling::copy_slowness_to_device()
+void Modeling::set_warm_start(float * previous, float reset_time)
 {
-    cudaMemcpy(d_S, S, volsize * sizeof(float), cudaMemcpyHostToDevice);
+    T_warm = previous;
+    t_warm = reset_time;
 }
 
 __global__ void time_set(float * T, int volsize)
@@ -367,6 +884,13 @@ __global__ void time_set(float * T, int volsize)
     if (index < volsize) T[index] = 1e6f;
 }
 
+__global__ void time_reset(float * T, float reset_time, int volsize)
+{
+    int index = threadIdx.x + blockIdx.x * blockDim.x;
+
+    if ((index < volsize) && (T[index] >= reset_time)) T[index] = 1e6f;
+}
+
 __global__ void time_init(float * T, float * S, float sx, float sy, float sz, float dx, float dy, 
                           float dz, int sIdx, int sIdy, int sIdz, int nxx, int nzz, int nb)
 {
@@ -385,6 +909,105 @@ __global__ void time_init(float * T, float * S, float sx, float sy, float sz, fl
                                 powf((zi - nb)*dz - sz, 2.0f));
 }
 
+__device__ SweepSlowness sweep_slowness(float * S, int i, int j, int k, int i1, int j1, int k1, int nxx, int nyy, int nzz)
+{
+    SweepSlowness s;
+
+    //------------------- 1D operators ------------------------------------------------------------------------------------------------------------------------
+    s.S1D1 = min(S[i1 + max(j-1,1)*nzz   + max(k-1,1)*nxx*nzz], 
+             min(S[i1 + max(j-1,1)*nzz   + min(k,nyy-1)*nxx*nzz], 
+             min(S[i1 + min(j,nxx-1)*nzz + max(k-1,1)*nxx*nzz],
+                 S[i1 + min(j,nxx-1)*nzz + min(k,nyy-1)*nxx*nzz])));                                     
+
+    s.S1D2 = min(S[max(i-1,1)   + j1*nzz + max(k-1,1)*nxx*nzz], 
+             min(S[min(i,nzz-1) + j1*nzz + max(k-1,1)*nxx*nzz],
+             min(S[max(i-1,1)   + j1*nzz + min(k,nyy-1)*nxx*nzz], 
+                 S[min(i,nzz-1) + j1*nzz + min(k,nyy-1)*nxx*nzz])));                    
+
+    s.S1D3 = min(S[max(i-1,1)   + max(j-1,1)*nzz   + k1*nxx*nzz], 
+             min(S[max(i-1,1)   + min(j,nxx-1)*nzz + k1*nxx*nzz],
+             min(S[min(i,nzz-1) + max(j-1,1)*nzz   + k1*nxx*nzz], 
+                 S[min(i,nzz-1) + min(j,nxx-1)*nzz + k1*nxx*nzz])));
+
+    //------------------- 2D operators - XZ, YZ and XY planes -------------------------------------------------------------------------------------------------
+    s.Sxz = min(S[i1 + j1*nzz + max(k-1,1)*nxx*nzz], S[i1 + j1*nzz + min(k, nyy-1)*nxx*nzz]);
+    s.Syz = min(S[i1 + max(j-1,1)*nzz + k1*nxx*nzz], S[i1 + min(j,nxx-1)*nzz + k1*nxx*nzz]);
+    s.Sxy = min(S[max(i-1,1) + j1*nzz + k1*nxx*nzz],S[min(i,nzz-1) + j1*nzz + k1*nxx*nzz]);
+
+    //------------------- 3D operator -------------------------------------------------------------------------------------------------------------------------
+    s.Sref = S[i1 + j1*nzz + k1*nxx*nzz];
+
+    return s;
+}
+
+__device__ float sweep_update(const SweepSlowness &s, float tv, float te, float tn, float tev, float ten, float tnv, float tnve, float dx, float dy, float dz, 
+                              float dx2i, float dy2i, float dz2i, float dz2dx2, float dz2dy2, float dx2dy2, float dsum)
+{
+    float ta, tb, tc, t1, t2, t3;
+    float t1D1, t1D2, t1D3, t1D, t2D1, t2D2, t2D3, t2D, t3D;
+
+    t1D1 = tv + dz * s.S1D1;
+    t1D2 = te + dx * s.S1D2;
+    t1D3 = tn + dy * s.S1D3;
+
+    t1D = min(t1D1, min(t1D2, t1D3));
+
+    //------------------- 2D operators - 4 points operator ---------------------------------------------------------------------------------------------------
+    t2D1 = 1e6; t2D2 = 1e6; t2D3 = 1e6;
+
+    // XZ plane ----------------------------------------------------------------------------------------------------------------------------------------------
+    if ((tv < te + dx*s.Sxz) && (te < tv + dz*s.Sxz))
+    {
+        ta = tev + te - tv;
+        tb = tev - te + tv;
+
+        t2D1 = ((tb*dz2i + ta*dx2i) + sqrtf(4.0f*s.Sxz*s.Sxz*(dz2i + dx2i) - dz2i*dx2i*(ta - tb)*(ta - tb))) / (dz2i + dx2i);
+    }
+
+    // YZ plane -------------------------------------------------------------------------------------------------------------------------------------------------------------
+    if((tv < tn + dy*s.Syz) && (tn < tv + dz*s.Syz))
+    {
+        ta = tv - tn + tnv;
+        tb = tn - tv + tnv;
+        
+        t2D2 = ((ta*dz2i + tb*dy2i) + sqrtf(4.0f*s.Syz*s.Syz*(dz2i + dy2i) - dz2i*dy2i*(ta - tb)*(ta - tb))) / (dz2i + dy2i); 
+    }
+
+    // XY plane -------------------------------------------------------------------------------------------------------------------------------------------------------------
+    if((te < tn + dy*s.Sxy) && (tn < te + dx*s.Sxy))
+    {
+        ta = te - tn + ten;
+        tb = tn - te + ten;
+
+        t2D3 = ((ta*dx2i + tb*dy2i) + sqrtf(4.0f*s.Sxy*s.Sxy*(dx2i + dy2i) - dx2i*dy2i*(ta - tb)*(ta - tb))) / (dx2i + dy2i);
+    }
+
+    t2D = min(t2D1, min(t2D2, t2D3));
+
+    //------------------- 3D operators - 8 point operator ---------------------------------------------------------------------------------------------------
+    t3D = 1e6;
+
+    ta = te - 0.5f*tn + 0.5f*ten - 0.5f*tv + 0.5f*tev - tnv + tnve;
+    tb = tv - 0.5f*tn + 0.5f*tnv - 0.5f*te + 0.5f*tev - ten + tnve;
+    tc = tn - 0.5f*te + 0.5f*ten - 0.5f*tv + 0.5f*tnv - tev + tnve;
+
+    if (min(t1D, t2D) > max(tv, max(te, tn)))
+    {
+        t2 = 9.0f*s.Sref*s.Sref*dsum; 
+        
+        t3 = dz2dx2*(ta - tb)*(ta - tb) + dz2dy2*(tb - tc)*(tb - tc) + dx2dy2*(ta - tc)*(ta - tc);
+        
+        if (t2 >= t3)
+        {
+            t1 = tb*dz2i + ta*dx2i + tc*dy2i;        
+            
+            t3D = (t1 + sqrtf(t2 - t3)) / dsum;
+        }
+    }
+
+    return min(t1D, min(t2D, t3D));
+}
+
 __global__ void inner_sweep(float * S, float * T, int * sgnt, int * sgnv, int sgni, int sgnj, int sgnk, 
                             int level, int xOffset, int yOffset, int xSweepOffset, int ySweepOffset, int zSweepOffset, 
                             int nxx, int nyy, int nzz, float dx, float dy, float dz, float dx2i, float dy2i, float dz2i, 
@@ -393,9 +1016,6 @@ __global__ void inner_sweep(float * S, float * T, int * sgnt, int * sgnv, int sg
     int x = (blockIdx.x * blockDim.x + threadIdx.x) + xOffset;
     int y = (blockIdx.y * blockDim.y + threadIdx.y) + yOffset;
 
-    float ta, tb, tc, t1, t2, t3, Sref;
-    float t1D1, t1D2, t1D3, t1D, t2D1, t2D2, t2D3, t2D, t3D;
-
     if ((x < nxx) && (y < nyy)) 
     {
 	    int z = level - (x + y);
@@ -424,85 +1044,61 @@ __global__ void inner_sweep(float * S, float * T, int * sgnt, int * sgnv, int sg
                         
                 float tnve = T[(i - sgnt[sgni]) + (j - sgnt[sgnj])*nzz + (k - sgnt[sgnk])*nxx*nzz];
 
-                t1D1 = tv + dz * min(S[i1 + max(j-1,1)*nzz   + max(k-1,1)*nxx*nzz], 
-                                 min(S[i1 + max(j-1,1)*nzz   + min(k,nyy-1)*nxx*nzz], 
-                                 min(S[i1 + min(j,nxx-1)*nzz + max(k-1,1)*nxx*nzz],
-                                     S[i1 + min(j,nxx-1)*nzz + min(k,nyy-1)*nxx*nzz])));                                     
-
-                t1D2 = te + dx * min(S[max(i-1,1)   + j1*nzz + max(k-1,1)*nxx*nzz], 
-                                 min(S[min(i,nzz-1) + j1*nzz + max(k-1,1)*nxx*nzz],
-                                 min(S[max(i-1,1)   + j1*nzz + min(k,nyy-1)*nxx*nzz], 
-                                     S[min(i,nzz-1) + j1*nzz + min(k,nyy-1)*nxx*nzz])));                    
-
-                t1D3 = tn + dy * min(S[max(i-1,1)   + max(j-1,1)*nzz   + k1*nxx*nzz], 
-                                 min(S[max(i-1,1)   + min(j,nxx-1)*nzz + k1*nxx*nzz],
-                                 min(S[min(i,nzz-1) + max(j-1,1)*nzz   + k1*nxx*nzz], 
-                                     S[min(i,nzz-1) + min(j,nxx-1)*nzz + k1*nxx*nzz])));
-
-                t1D = min(t1D1, min(t1D2, t1D3));
-
-                //------------------- 2D operators - 4 points operator ---------------------------------------------------------------------------------------------------
-                t2D1 = 1e6; t2D2 = 1e6; t2D3 = 1e6;
+                SweepSlowness s = sweep_slowness(S, i, j, k, i1, j1, k1, nxx, nyy, nzz);
 
-                // XZ plane ----------------------------------------------------------------------------------------------------------------------------------------------
-                Sref = min(S[i1 + j1*nzz + max(k-1,1)*nxx*nzz], S[i1 + j1*nzz + min(k, nyy-1)*nxx*nzz]);
-                
-                if ((tv < te + dx*Sref) && (te < tv + dz*Sref))
-                {
-                    ta = tev + te - tv;
-                    tb = tev - te + tv;
-
-                    t2D1 = ((tb*dz2i + ta*dx2i) + sqrtf(4.0f*Sref*Sref*(dz2i + dx2i) - dz2i*dx2i*(ta - tb)*(ta - tb))) / (dz2i + dx2i);
-                }
+		        T[ijk] = min(T[ijk], sweep_update(s, tv, te, tn, tev, ten, tnv, tnve, dx, dy, dz, dx2i, dy2i, dz2i, dz2dx2, dz2dy2, dx2dy2, dsum));
+            }
+        }
+    }
+}
 
-                // YZ plane -------------------------------------------------------------------------------------------------------------------------------------------------------------
-                Sref = min(S[i1 + max(j-1,1)*nzz + k1*nxx*nzz], S[i1 + min(j,nxx-1)*nzz + k1*nxx*nzz]);
+__global__ void inner_sweep_batch(float * S, float * T, int * sgnt, int * sgnv, int sgni, int sgnj, int sgnk, 
+                                  int level, int xOffset, int yOffset, int xSweepOffset, int ySweepOffset, int zSweepOffset, 
+                                  int nxx, int nyy, int nzz, float dx, float dy, float dz, float dx2i, float dy2i, float dz2i, 
+                                  float dz2dx2, float dz2dy2, float dx2dy2, float dsum, int shots, int volsize)
+{
+    int x = (blockIdx.x * blockDim.x + threadIdx.x) + xOffset;
+    int y = (blockIdx.y * blockDim.y + threadIdx.y) + yOffset;
 
-                if((tv < tn + dy*Sref) && (tn < tv + dz*Sref))
-                {
-                    ta = tv - tn + tnv;
-                    tb = tn - tv + tnv;
-                    
-                    t2D2 = ((ta*dz2i + tb*dy2i) + sqrtf(4.0f*Sref*Sref*(dz2i + dy2i) - dz2i*dy2i*(ta - tb)*(ta - tb))) / (dz2i + dy2i); 
-                }
+    if ((x < nxx) && (y < nyy)) 
+    {
+	    int z = level - (x + y);
+		
+        if ((z >= 0) && (z < nzz))	
+        {
+            int i = abs(z - zSweepOffset);
+            int j = abs(x - xSweepOffset);
+            int k = abs(y - ySweepOffset);
 
-                // XY plane -------------------------------------------------------------------------------------------------------------------------------------------------------------
-                Sref = min(S[max(i-1,1) + j1*nzz + k1*nxx*nzz],S[min(i,nzz-1) + j1*nzz + k1*nxx*nzz]);
+            if ((i > 0) && (i < nzz-1) && (j > 0) && (j < nxx-1) && (k > 0) && (k < nyy-1))
+            {		
+                int i1 = i - sgnv[sgni];
+                int j1 = j - sgnv[sgnj];
+                int k1 = k - sgnv[sgnk];
 
-                if((te < tn + dy*Sref) && (tn < te + dx*Sref))
-                {
-                    ta = te - tn + ten;
-                    tb = tn - te + ten;
+                int ijk = i + j*nzz + k*nxx*nzz;
 
-                    t2D3 = ((ta*dx2i + tb*dy2i) + sqrtf(4.0f*Sref*Sref*(dx2i + dy2i) - dx2i*dy2i*(ta - tb)*(ta - tb))) / (dx2i + dy2i);
-                }
+                int iv = (i - sgnt[sgni]) + j*nzz + k*nxx*nzz;
+                int ie = i + (j - sgnt[sgnj])*nzz + k*nxx*nzz;
+                int in = i + j*nzz + (k - sgnt[sgnk])*nxx*nzz;
 
-                t2D = min(t2D1, min(t2D2, t2D3));
+                int iev = (i - sgnt[sgni]) + (j - sgnt[sgnj])*nzz + k*nxx*nzz;
+                int ien = i + (j - sgnt[sgnj])*nzz + (k - sgnt[sgnk])*nxx*nzz;
+                int inv = (i - sgnt[sgni]) + j*nzz + (k - sgnt[sgnk])*nxx*nzz;
 
-                //------------------- 3D operators - 8 point operator ---------------------------------------------------------------------------------------------------
-                t3D = 1e6;
+                int inve = (i - sgnt[sgni]) + (j - sgnt[sgnj])*nzz + (k - sgnt[sgnk])*nxx*nzz;
 
-                Sref = S[i1 + j1*nzz + k1*nxx*nzz];
+                // the slowness stencil depends on the sweep only, it is read once for every shot
 
-                ta = te - 0.5f*tn + 0.5f*ten - 0.5f*tv + 0.5f*tev - tnv + tnve;
-                tb = tv - 0.5f*tn + 0.5f*tnv - 0.5f*te + 0.5f*tev - ten + tnve;
-                tc = tn - 0.5f*te + 0.5f*ten - 0.5f*tv + 0.5f*tnv - tev + tnve;
+                SweepSlowness s = sweep_slowness(S, i, j, k, i1, j1, k1, nxx, nyy, nzz);
 
-                if (min(t1D, t2D) > max(tv, max(te, tn)))
+                for (int shot = 0; shot < shots; shot++)
                 {
-                    t2 = 9.0f*Sref*Sref*dsum; 
-                    
-                    t3 = dz2dx2*(ta - tb)*(ta - tb) + dz2dy2*(tb - tc)*(tb - tc) + dx2dy2*(ta - tc)*(ta - tc);
-                    
-                    if (t2 >= t3)
-                    {
-                        t1 = tb*dz2i + ta*dx2i + tc*dy2i;        
-                        
-                        t3D = (t1 + sqrtf(t2 - t3)) / dsum;
-                    }
-                }
+                    float * Ts = T + shot*volsize;
 
-		        T[ijk] = min(T[ijk], min(t1D, min(t2D, t3D)));
+                    Ts[ijk] = min(Ts[ijk], sweep_update(s, Ts[iv], Ts[ie], Ts[in], Ts[iev], Ts[ien], Ts[inv], Ts[inve], dx, dy, dz, 
+                                                        dx2i, dy2i, dz2i, dz2dx2, dz2dy2, dx2dy2, dsum));
+                }
             }
         }
     }
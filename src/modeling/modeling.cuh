@@ -1,15 +1,16 @@
 # ifndef MODELING_CUH
 # define MODELING_CUH
 
+# include <tuple>
 # include <cuda_runtime.h>
 
+# include "quantized.hpp"
+# include "../admin/workspace.hpp"
 # include "../geometry/geometry.hpp"
 
 # define NSWEEPS 8
 # define MESHDIM 3
 
-# define COMPRESS 65535
-
 typedef unsigned short int uintc; 
 
 class Modeling
@@ -19,12 +20,35 @@ private:
     void set_eikonal();
     void set_properties();
 
+    void set_domain_decomposition();
+    void allocate_bricks();
+
+    float solve_brick(int bx, int by, int slot);
+
+    void decomposed_solver();
+
     int iDivUp(int a, int b);
 
     float cubic1d(float P[4], float dx);
     float cubic2d(float P[4][4], float dx, float dy);
     float cubic3d(float P[4][4][4], float dx, float dy, float dz);
 
+    float get_travel_time(float x, float y, float z);
+
+    std::string seismogram_file();
+
+    std::vector<int> trace_first;
+    std::vector<int> trace_shot;
+    std::vector<std::vector<int>> station_traces;
+
+    float * gathers = nullptr;
+
+    float * d_TB = nullptr;
+
+    std::vector<float> batch_sx;
+    std::vector<float> batch_sy;
+    std::vector<float> batch_sz;
+
 protected:
 
     int total_levels;
@@ -36,9 +60,36 @@ protected:
     int * d_sgnv = nullptr;
     int * d_sgnt = nullptr;
 
+    // workers borrow the slowness, geometry, sweep tables and batch buffers of their solver
+
+    bool shared_buffers = false;
+
+    float t_warm;
+    float * T_warm = nullptr;
+
+    int bricks_x, bricks_y, brick_halo;
+    int brick_threads, max_exchanges;
+    int brick_nxx, brick_nyy;
+
+    float exchange_tolerance;
+
+    std::vector<int> brick_x0, brick_x1;
+    std::vector<int> brick_y0, brick_y1;
+
+    std::vector<char> brick_active;
+
+    float ** h_brick_T = nullptr;
+    float ** d_brick_T = nullptr;
+    float ** d_brick_S = nullptr;
+
     virtual void set_conditions() = 0;
-    
-    void compression(float * input, uintc * output, int volsize, float &max_value, float &min_value);
+
+    virtual Modeling * clone() = 0;
+
+    virtual void plan_memory();
+
+
+    void eikonal_sweep(float * S, float * T, int mxx, int myy, int mzz, int shots = 1);
 
 public:
 
@@ -55,16 +106,32 @@ public:
     float * d_T = nullptr;
     float * d_S = nullptr;
 
+    bool domain_decomposition;
+
     float * seismogram = nullptr;
 
+    bool reciprocity = false;
+    int stationId, nStations;
+    std::vector<int> station_rec;
+
+    Workspace workspace;
+
+    double host_bytes, device_bytes;
+    double host_budget, device_budget;
+
+    bool fits_memory_budget();
+    void check_memory_budget(std::string stage);
+
     int max_spread;
-    Geometry * geometry;
+    Geometry * geometry = nullptr;
     
     std::string parameters;
     std::string data_folder;
     std::string modeling_type;
     std::string modeling_name;
 
+    virtual ~Modeling();
+
     void set_parameters();
     void initialization();
     void eikonal_solver();
@@ -72,7 +139,13 @@ public:
     void show_information();    
     void compute_seismogram();
 
-    void copy_slowness_to_device();
+    virtual void copy_slowness_to_device();
+    virtual void update_worker(Modeling * worker);
+    void copy_time_to_host();
+
+    void set_warm_start(float * previous, float reset_time);
+
+    Modeling * create_worker();
 
     void expand_boundary(float * input, float * output);
     void reduce_boundary(float * input, float * output);
@@ -80,16 +153,49 @@ public:
     virtual void time_propagation() = 0;
 
     void export_seismogram();
+
+    void set_reciprocity();
+    void set_station_point();
+    void compute_reciprocal_traces();
+    void export_reciprocal_seismograms();
+
+    int shot_batch = 1;
+
+    void set_shot_batch();
+    void add_batch_point(int slot);
+    void batch_propagation(int count);
+    void get_batch_time(int slot);
 };
 
 __global__ void time_set(float * T, int volsize);
 
+__global__ void time_reset(float * T, float reset_time, int volsize);
+
 __global__ void time_init(float * T, float * S, float sx, float sy, float sz, float dx, float dy, 
                           float dz, int sIdx, int sIdy, int sIdz, int nxx, int nzz, int nb);
 
+// upwind slowness of the 1D, 2D and 3D operators at one grid point for the current sweep direction
+
+struct SweepSlowness
+{
+    float S1D1, S1D2, S1D3;
+    float Sxz, Syz, Sxy;
+    float Sref;
+};
+
+__device__ SweepSlowness sweep_slowness(float * S, int i, int j, int k, int i1, int j1, int k1, int nxx, int nyy, int nzz);
+
+__device__ float sweep_update(const SweepSlowness &s, float tv, float te, float tn, float tev, float ten, float tnv, float tnve, float dx, float dy, float dz, 
+                              float dx2i, float dy2i, float dz2i, float dz2dx2, float dz2dy2, float dx2dy2, float dsum);
+
 __global__ void inner_sweep(float * S, float * T, int * sgnt, int * sgnv, int sgni, int sgnj, int sgnk, 
                             int level, int xOffset, int yOffset, int xSweepOffset, int ySweepOffset, int zSweepOffset, 
                             int nxx, int nyy, int nzz, float dx, float dy, float dz, float dx2i, float dy2i, float dz2i, 
                             float dz2dx2, float dz2dy2, float dx2dy2, float dsum);
 
+__global__ void inner_sweep_batch(float * S, float * T, int * sgnt, int * sgnv, int sgni, int sgnj, int sgnk, 
+                                  int level, int xOffset, int yOffset, int xSweepOffset, int ySweepOffset, int zSweepOffset, 
+                                  int nxx, int nyy, int nzz, float dx, float dy, float dz, float dx2i, float dy2i, float dz2i, 
+                                  float dz2dx2, float dz2dy2, float dx2dy2, float dsum, int shots, int volsize);
+
 # endif
\ No newline at end of file
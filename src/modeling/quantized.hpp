@@ -0,0 +1,144 @@
+# ifndef QUANTIZED_HPP
+# define QUANTIZED_HPP
+
+# include <omp.h>
+# include <cmath>
+# include <limits>
+# include <string>
+# include <stdexcept>
+# include <algorithm>
+
+// Linear quantization of a float volume into 8 or 16 bit words. The volume is
+// split in contiguous bricks with their own offset and scale, so brick_size = size
+// gives a single global scale. Reconstruction error is bounded by half a step.
+// Encoded ranges cover whole bricks, a brick is never rescaled from part of its values.
+
+template <typename word>
+class Quantized
+{
+public:
+
+    int size = 0;
+    int n_bricks = 0;
+    int brick_size = 0;
+
+    float max_error = 0.0f;
+
+    word * data = nullptr;
+
+    float * scale = nullptr;
+    float * offset = nullptr;
+
+    void allocate(int volume_size, int volume_brick);
+    void release();
+
+    void encode(float * input, int first, int count);
+    void decode(float * output, int first, int count);
+};
+
+template <typename word>
+void Quantized<word>::allocate(int volume_size, int volume_brick)
+{
+    size = volume_size;
+    brick_size = volume_brick;
+    n_bricks = (size + brick_size - 1) / brick_size;
+
+    max_error = 0.0f;
+
+    data = new word[size]();
+
+    scale = new float[n_bricks]();
+    offset = new float[n_bricks]();
+}
+
+template <typename word>
+void Quantized<word>::release()
+{
+    delete[] data;
+    delete[] scale;
+    delete[] offset;
+
+    data = nullptr;
+    scale = nullptr;
+    offset = nullptr;
+}
+
+template <typename word>
+void Quantized<word>::encode(float * input, int first, int count)
+{
+    const float levels = static_cast<float>(std::numeric_limits<word>::max());
+
+    if ((first % brick_size != 0) || (((first + count) % brick_size != 0) && (first + count < size)))
+        throw std::invalid_argument("Error: \033[31mquantized range " + std::to_string(first) + " + " + std::to_string(count) + 
+                                    "\033[0;0m is not aligned to bricks of " + std::to_string(brick_size) + " values!");
+
+    int b0 = first / brick_size;
+    int b1 = (first + count + brick_size - 1) / brick_size;
+
+    float error = 0.0f;
+
+    // bricks are spread over threads, a single global brick is reduced in parallel instead
+
+    # pragma omp parallel for reduction(max:error) if(b1 - b0 > 1)
+    for (int b = b0; b < b1; b++)
+    {
+        int begin = std::max(b*brick_size, first);
+        int end = std::min((b + 1)*brick_size, std::min(first + count, size));
+
+        float * values = input + (begin - first);
+
+        float min_value = values[0];
+        float max_value = values[0];
+
+        # pragma omp parallel for simd reduction(min:min_value) reduction(max:max_value) if(b1 - b0 == 1)
+        for (int index = 0; index < end - begin; index++)
+        {
+            min_value = std::min(min_value, values[index]);
+            max_value = std::max(max_value, values[index]);
+        }
+
+        float range = max_value - min_value;
+
+        offset[b] = min_value;
+        scale[b] = (range > 0.0f) ? range / levels : 0.0f;
+
+        float inverse = (range > 0.0f) ? levels / range : 0.0f;
+
+        word * q = data + begin;
+
+        # pragma omp parallel for simd if(b1 - b0 == 1)
+        for (int index = 0; index < end - begin; index++)
+            q[index] = static_cast<word>((values[index] - min_value)*inverse + 0.5f);
+
+        error = std::max(error, 0.5f*scale[b]);
+    }
+
+    max_error = std::max(max_error, error);
+}
+
+template <typename word>
+void Quantized<word>::decode(float * output, int first, int count)
+{
+    int b0 = first / brick_size;
+    int b1 = (first + count + brick_size - 1) / brick_size;
+
+    # pragma omp parallel for if(b1 - b0 > 1)
+    for (int b = b0; b < b1; b++)
+    {
+        int begin = std::max(b*brick_size, first);
+        int end = std::min((b + 1)*brick_size, std::min(first + count, size));
+
+        float * values = output + (begin - first);
+
+        word * q = data + begin;
+
+        float brick_scale = scale[b];
+        float brick_offset = offset[b];
+
+        # pragma omp simd
+        for (int index = 0; index < end - begin; index++)
+            values[index] = brick_offset + brick_scale*static_cast<float>(q[index]);
+    }
+}
+
+# endif
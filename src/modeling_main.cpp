@@ -15,21 +15,65 @@ int main(int argc, char **argv)
     modeling[type]->parameters = file;
     
     modeling[type]->set_parameters();
+    modeling[type]->set_reciprocity();
+    modeling[type]->set_shot_batch();
+
+    bool reciprocity = modeling[type]->reciprocity;
+
+    int batch = modeling[type]->shot_batch;
+    int solves = (reciprocity) ? modeling[type]->nStations : modeling[type]->geometry->nrel;
 
     auto ti = std::chrono::system_clock::now();
 
-    for (int shot = 0; shot < modeling[type]->geometry->nrel; shot++)
+    for (int first = 0; first < solves; first += batch)
     {
-        modeling[type]->srcId = shot;
+        int count = std::min(batch, solves - first);
+
+        for (int slot = 0; slot < count; slot++)
+        {
+            if (reciprocity)
+            {
+                modeling[type]->stationId = first + slot;
+                modeling[type]->set_station_point();
+            }
+            else
+            {
+                modeling[type]->srcId = first + slot;
+                modeling[type]->set_shot_point();
+            }
+
+            modeling[type]->show_information();
+            modeling[type]->add_batch_point(slot);
+        }
+
+        modeling[type]->batch_propagation(count);
 
-        modeling[type]->set_shot_point();
-        modeling[type]->show_information();
-        modeling[type]->time_propagation();
-        modeling[type]->export_seismogram();
+        for (int slot = 0; slot < count; slot++)
+        {
+            modeling[type]->get_batch_time(slot);
+
+            if (reciprocity)
+            {
+                modeling[type]->stationId = first + slot;
+                modeling[type]->compute_reciprocal_traces();
+            }
+            else
+            {
+                modeling[type]->srcId = first + slot;
+                modeling[type]->export_seismogram();
+            }
+        }
     }
 
+    if (reciprocity) 
+        modeling[type]->export_reciprocal_seismograms();
+
     auto tf = std::chrono::system_clock::now();
 
+    show_peak_memory("modeling");
+
+    export_configuration("modeling", file);
+
     std::chrono::duration<double> elapsed_seconds = tf - ti;
     std::cout << "\nRun time: " << elapsed_seconds.count() << " s." << std::endl;
     
@@ -0,0 +1,166 @@
+import os
+import ctypes
+import numpy as np
+
+# In-process access to the solvers through bin/libseisfat3d.so (run/program.sh -library).
+# Volumes and gathers are numpy views over the library buffers: writing into them
+# changes the solver state, and they stay valid while the owning object lives.
+# Objects release their solver on close(), at the end of a with block or when
+# they are collected; the modeling of a migration or inversion is released with it.
+
+library_path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "../bin/libseisfat3d.so")
+
+lib = ctypes.CDLL(os.environ.get("SEISFAT3D_LIBRARY", library_path))
+
+float_pointer = ctypes.POINTER(ctypes.c_float)
+int_array = ctypes.POINTER(ctypes.c_int)
+
+lib.sf_last_error.restype = ctypes.c_char_p
+lib.sf_catch_parameter.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int]
+
+for name in ["sf_modeling_create", "sf_migration_create"]:
+    getattr(lib, name).restype = ctypes.c_void_p
+    getattr(lib, name).argtypes = [ctypes.c_char_p, ctypes.c_int]
+
+lib.sf_inversion_create.restype = ctypes.c_void_p
+lib.sf_inversion_create.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int]
+
+for name in ["sf_migration_modeling", "sf_inversion_modeling"]:
+    getattr(lib, name).restype = ctypes.c_void_p
+    getattr(lib, name).argtypes = [ctypes.c_void_p]
+
+for name in ["sf_modeling_slowness", "sf_modeling_times", "sf_modeling_seismogram"]:
+    getattr(lib, name).restype = float_pointer
+    getattr(lib, name).argtypes = [ctypes.c_void_p]
+
+for name in ["sf_migration_image", "sf_inversion_observed"]:
+    getattr(lib, name).restype = float_pointer
+    getattr(lib, name).argtypes = [ctypes.c_void_p, int_array]
+
+for name in ["sf_modeling_solve", "sf_modeling_spread"]:
+    getattr(lib, name).argtypes = [ctypes.c_void_p, ctypes.c_int]
+
+for name in ["sf_migration_run", "sf_inversion_iterate", "sf_inversion_finish", "sf_modeling_update_slowness"]:
+    getattr(lib, name).argtypes = [ctypes.c_void_p]
+
+for name in ["sf_modeling_destroy", "sf_migration_destroy", "sf_inversion_destroy"]:
+    getattr(lib, name).argtypes = [ctypes.c_void_p]
+
+lib.sf_modeling_shape.argtypes = [ctypes.c_void_p, int_array]
+
+def check(result):
+    if result is None or (isinstance(result, int) and result < 0) or (isinstance(result, float_pointer) and not result):
+        raise RuntimeError(lib.sf_last_error().decode())
+    return result
+
+def view(pointer, n):
+    return np.ctypeslib.as_array(pointer, shape = (n,))
+
+def catch_parameter(parameters, target):
+    value = ctypes.create_string_buffer(1024)
+    check(lib.sf_catch_parameter(parameters.encode(), target.encode(), value, len(value)))
+    return value.value.decode()
+
+class Handle:
+
+    # only handles created by the object itself are destroyed, borrowed ones belong to their owner
+
+    destroy = None
+
+    def close(self):
+        handle, self.handle = getattr(self, "handle", None), None
+
+        if getattr(self, "modeling", None) is not None:
+            self.modeling.handle = None
+
+        if getattr(self, "owner", False) and handle is not None:
+            self.owner = False
+            check(getattr(lib, self.destroy)(handle))
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *error):
+        self.close()
+
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
+
+class Modeling(Handle):
+
+    destroy = "sf_modeling_destroy"
+
+    def __init__(self, parameters, modeling_type = None, handle = None):
+        self.owner = handle is None
+
+        if handle is None:
+            modeling_type = int(catch_parameter(parameters, "modeling_type")) if modeling_type is None else modeling_type
+            handle = check(lib.sf_modeling_create(parameters.encode(), modeling_type))
+
+        self.handle = handle
+
+        shape = (ctypes.c_int * 5)()
+        check(lib.sf_modeling_shape(self.handle, shape))
+
+        self.nzz, self.nxx, self.nyy, self.nb, self.nrel = shape
+        self.volsize = self.nzz*self.nxx*self.nyy
+
+    def volume(self, pointer):
+        return view(pointer, self.volsize).reshape([self.nzz, self.nxx, self.nyy], order = "F")
+
+    def slowness(self):
+        return self.volume(check(lib.sf_modeling_slowness(self.handle)))
+
+    def travel_times(self):
+        return self.volume(check(lib.sf_modeling_times(self.handle)))
+
+    def update_slowness(self):
+        check(lib.sf_modeling_update_slowness(self.handle))
+
+    def solve(self, shot):
+        check(lib.sf_modeling_solve(self.handle, shot))
+        return view(check(lib.sf_modeling_seismogram(self.handle)), check(lib.sf_modeling_spread(self.handle, shot)))
+
+class Migration(Handle):
+
+    destroy = "sf_migration_destroy"
+
+    def __init__(self, parameters, migration_type = None):
+        migration_type = int(catch_parameter(parameters, "migration_type")) if migration_type is None else migration_type
+        self.handle = check(lib.sf_migration_create(parameters.encode(), migration_type))
+        self.owner = True
+        self.modeling = Modeling(parameters, handle = check(lib.sf_migration_modeling(self.handle)))
+
+    def run(self):
+        check(lib.sf_migration_run(self.handle))
+
+    def image(self):
+        shape = (ctypes.c_int * 4)()
+        pointer = check(lib.sf_migration_image(self.handle, shape))
+        nz, nx, ny, classes = shape
+        return view(pointer, classes*nz*nx*ny).reshape([nz, nx, ny, classes], order = "F")
+
+class Inversion(Handle):
+
+    destroy = "sf_inversion_destroy"
+
+    def __init__(self, parameters, inversion_type = None, import_data = True):
+        inversion_type = int(catch_parameter(parameters, "inversion_type")) if inversion_type is None else inversion_type
+        self.handle = check(lib.sf_inversion_create(parameters.encode(), inversion_type, int(import_data)))
+        self.owner = True
+        self.modeling = Modeling(parameters, handle = check(lib.sf_inversion_modeling(self.handle)))
+
+    def observed_data(self):
+        size = ctypes.c_int()
+        pointer = check(lib.sf_inversion_observed(self.handle, ctypes.byref(size)))
+        return view(pointer, size.value)
+
+    def iterate(self):
+        return check(lib.sf_inversion_iterate(self.handle)) == 1
+
+    def run(self):
+        while not self.iterate(): pass
+        check(lib.sf_inversion_finish(self.handle))
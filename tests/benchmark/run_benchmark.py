@@ -0,0 +1,163 @@
+import sys; sys.path.append("../src/")
+
+import os
+import re
+import itertools
+import subprocess
+
+import numpy as np
+import matplotlib.pyplot as plt
+import functions as pyf
+
+parameters = str(sys.argv[1])
+
+# layered model with analytic first breaks, depth and width stay fixed while the grid changes
+
+v = np.array([1500, 1700, 1900, 2300])
+z = np.array([200, 300, 400])
+
+depth = 1500.0
+width = 400.0
+
+spacings = [float(s) for s in pyf.catch_parameter(parameters, "benchmark_spacing").split(",")]
+lengths = [float(s) for s in pyf.catch_parameter(parameters, "benchmark_length").split(",")]
+threads = [int(s) for s in pyf.catch_parameter(parameters, "benchmark_threads").split(",")]
+modes = pyf.catch_parameter(parameters, "benchmark_modes").split(",")
+
+ns = int(pyf.catch_parameter(parameters, "benchmark_shots"))
+batch = int(pyf.catch_parameter(parameters, "benchmark_batch"))
+bricks = int(pyf.catch_parameter(parameters, "benchmark_bricks"))
+
+report_folder = pyf.catch_parameter(parameters, "benchmark_report_folder")
+
+os.makedirs(report_folder, exist_ok = True)
+
+def set_parameter(text, key, value):
+    return re.sub(rf"^{key}\s*=.*$", f"{key} = {value}", text, flags = re.M)
+
+def mode_parameters(mode, nthreads):
+    keys = {"shot_batch": 1, "reciprocity": "false", "domain_bricks_x": 1, "domain_threads": 1}
+
+    if mode == "batch": keys["shot_batch"] = batch
+    if mode == "reciprocity": keys["reciprocity"] = "true"
+    if mode == "bricks": keys.update({"domain_bricks_x": bricks, "domain_threads": nthreads})
+
+    return keys
+
+def generate_case(text, dh, length):
+    nx = int(length / dh) + 1
+    ny = int(width / dh) + 1
+    nz = int(depth / dh) + 1
+
+    for key, value in {"x_samples": nx, "y_samples": ny, "z_samples": nz, "x_spacing": dh, "y_spacing": dh, "z_spacing": dh}.items():
+        text = set_parameter(text, key, value)
+
+    # interfaces snap to the nearest node, the analytic first breaks use the gridded thicknesses
+    # so that only the solver error is measured
+
+    interfaces = np.round(np.cumsum(z) / dh).astype(int)
+    zg = np.diff(np.append(0, interfaces))*dh
+
+    Vp = np.zeros((nz,nx,ny)) + v[0]
+    for i in range(len(z)):
+        Vp[interfaces[i]:] = v[i+1]
+
+    Vp.flatten("F").astype(np.float32, order = "F").tofile(pyf.catch_parameter(parameters, "vp_model_file"))
+
+    nr = int(length / 50.0) + 1
+
+    SPS = np.zeros((ns, 3))
+    RPS = np.zeros((nr, 3))
+    XPS = np.zeros((ns, 3))
+
+    SPS[:, 0] = np.linspace(0.1*length, 0.9*length, ns)
+    SPS[:, 1] = 0.5*width
+
+    RPS[:, 0] = np.linspace(0, length, nr)
+    RPS[:, 1] = 0.5*width
+
+    XPS[:, 0] = np.arange(ns)
+    XPS[:, 2] = nr
+
+    np.savetxt(pyf.catch_parameter(parameters, "SPS"), SPS, fmt = "%.2f", delimiter = ",")
+    np.savetxt(pyf.catch_parameter(parameters, "RPS"), RPS, fmt = "%.2f", delimiter = ",")
+    np.savetxt(pyf.catch_parameter(parameters, "XPS"), XPS, fmt = "%.0f", delimiter = ",")
+
+    return text, SPS, RPS, zg
+
+def first_break_error(SPS, RPS, zg):
+    output_folder = pyf.catch_parameter(parameters, "modeling_output_folder")
+
+    errors = []
+
+    for i in range(ns):
+        x = np.sqrt((SPS[i,0] - RPS[:,0])**2 + (SPS[i,1] - RPS[:,1])**2)
+
+        analytic = np.minimum(x / v[0], np.min(pyf.get_analytical_refractions(v,zg,x), axis = 0))
+        numeric = pyf.read_binary_array(len(RPS), output_folder + f"eikonal_iso_nStations{len(RPS)}_shot_{i+1}.bin")
+
+        errors.append(np.abs(analytic - numeric))
+
+    errors = np.concatenate(errors)
+
+    return 1e3*np.max(errors), 1e3*np.mean(errors)
+
+base = open(parameters, "r").read()
+case_parameters = os.path.join(report_folder, "benchmark_case_parameters.txt")
+
+report = []
+
+for dh, length in itertools.product(spacings, lengths):
+
+    text, SPS, RPS, zg = generate_case(base, dh, length)
+
+    for mode, nthreads in itertools.product(modes, threads):
+
+        case = text
+        for key, value in mode_parameters(mode, nthreads).items():
+            case = set_parameter(case, key, value)
+
+        open(case_parameters, "w").write(case)
+
+        environment = dict(os.environ, OMP_NUM_THREADS = str(nthreads))
+
+        # the solver reports the time of its shot loop, model loading and device setup stay out
+
+        output = subprocess.run(["../bin/modeling.exe", case_parameters], env = environment, check = True, capture_output = True, text = True).stdout
+
+        solve_time = float(re.search(r"Run time: ([0-9.eE+-]+) s", output).group(1))
+
+        max_error, mean_error = first_break_error(SPS, RPS, zg)
+
+        report.append((mode, nthreads, dh, length, max_error, mean_error, solve_time / ns))
+
+        print(f"{mode:12s} threads {nthreads:3d} dh {dh:6.1f} m length {length:8.1f} m: max error {max_error:8.3f} ms, {solve_time / ns:8.3f} s/shot")
+
+# a case is on the front when no other case is both faster and more accurate
+
+pareto = [not any((o[6] <= r[6]) and (o[4] <= r[4]) and (o != r) for o in report) for r in report]
+
+with open(report_folder + "benchmark_report.csv", "w") as file:
+    file.write("mode,threads,spacing_m,length_m,max_error_ms,mean_error_ms,time_per_shot_s,pareto\n")
+    for r, front in zip(report, pareto):
+        file.write(f"{r[0]},{r[1]},{r[2]},{r[3]},{r[4]:.6f},{r[5]:.6f},{r[6]:.6f},{int(front)}\n")
+
+fig, ax = plt.subplots(figsize = (10, 6))
+
+for mode in modes:
+    cases = np.array([[r[6], r[4]] for r in report if r[0] == mode])
+    ax.scatter(cases[:,0], cases[:,1], label = mode)
+
+front = np.array(sorted([[r[6], r[4]] for r, f in zip(report, pareto) if f]))
+ax.plot(front[:,0], front[:,1], "k--", label = "Pareto front")
+
+ax.set_xscale("log")
+ax.set_yscale("log")
+
+ax.set_xlabel("Solve time per shot [s]", fontsize = 15)
+ax.set_ylabel("Max first-break error [ms]", fontsize = 15)
+
+ax.legend(loc = "upper right")
+
+fig.tight_layout()
+plt.savefig(report_folder + "benchmark_pareto.png", dpi = 200)
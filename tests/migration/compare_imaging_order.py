@@ -0,0 +1,42 @@
+import sys; sys.path.append("../src/")
+
+import os
+import re
+import glob
+import subprocess
+
+import numpy as np
+import functions as pyf
+
+parameters = str(sys.argv[1])
+
+# receiver-major imaging adds the same trace contributions as the shot-major order, only
+# in another sequence, so the images may differ by float rounding of the per-voxel sums
+
+tolerance = 1e-4
+
+output_image_folder = pyf.catch_parameter(parameters, "output_image_folder")
+
+def migrate(receiver_major):
+    text = re.sub(r"^receiver_major\s*=.*$", f"receiver_major = {receiver_major}", open(parameters, "r").read(), flags = re.M)
+
+    case_parameters = parameters.replace(".txt", f"_receiver_major_{receiver_major}.txt")
+
+    open(case_parameters, "w").write(text)
+
+    subprocess.run(["../bin/migration.exe", case_parameters], check = True, stdout = subprocess.DEVNULL)
+
+    os.remove(case_parameters)
+
+    result = max(glob.glob(output_image_folder + "kirchhoff_result_*.bin"), key = os.path.getmtime)
+
+    return np.fromfile(result, dtype = np.float32)
+
+shot_major = migrate("false")
+receiver_major = migrate("true")
+
+error = np.max(np.abs(receiver_major - shot_major)) / np.max(np.abs(shot_major))
+
+print(f"Receiver-major against shot-major image: relative max difference {error:.3e} (tolerance {tolerance:.0e})")
+
+sys.exit(0 if error <= tolerance else 1)